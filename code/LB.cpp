@@ -1,37 +1,175 @@
 /*
- * lb_smartLB.cpp – Thread‑per‑client + SERPT scheduling (fixed alias name)
+ * lb_smartLB.cpp – Thread‑per‑client or epoll reactor engine + SERPT scheduling (fixed alias name)
+ *
+ *   ./lb [--workers=N]                threads engine: N blocking workers with work stealing
+ *                                     (default 64; 0 = a thread per client)
+ *   ./lb --engine=epoll --reactors=N  N non-blocking epoll reactor threads
+ *   ./lb --engine=uring --reactors=N  N io_uring reactor threads (falls back to epoll)
+ *   ./lb --engine=coro --reactors=N   N epoll reactor threads running a coroutine per client
+ *                                     (needs -std=c++20, else falls back to epoll)
+ *   --pool=N --pool-idle=SEC          upstream connections per backend, idle reap age (0 = never)
+ *   --pipeline=D                      up to D outstanding requests per upstream connection
+ *   --keepalive[=N]                   clients may send a stream of requests on one connection, up to N
+ *                                     (default 16) scheduled at once; replies come back in order
+ *   --policy=serpt|jsq|p2c|wrr|late   scheduling policy, --weights=w1,w2,.. for wrr; late (epoll engine)
+ *                                     holds requests until a backend has a connection free, then binds
+ *                                     the best‑ranked one for its role (elsewhere: serpt)
+ *   --adaptive=ALPHA                  EWMA weight for learned service costs (0 = static multiplier table)
+ *   --index-min=N                     backends from which SERPT picks use per‑role heaps instead of a
+ *                                     lock‑free (SIMD from 16) scan (default 16; ./sched_bench compares)
+ *   --metrics-port=PORT               serve Prometheus metrics over HTTP (0 = off)
+ *   --listeners=N --backlog=B --pin   SO_REUSEPORT listen sockets (default: one per reactor),
+ *                                     accept backlog, --pin: --cpus=reactor:all --cpus=acceptor:all
+ *   --cpus=CLASS:LIST                 run a thread class (reactor, acceptor, worker, health, metrics, aux)
+ *                                     on CPUs "0-3,8", NUMA nodes "node1", or "all" (see "thread placement")
+ *   --reply-len=N                     bytes per backend reply, relayed with splice() (default 2)
+ *   --config=FILE --listen=IP:PORT    options from a file (see load_config), listen address
+ *   --backend=ROLE@IP:PORT[/W]        add a backend (default: the three lab servers)
+ *   --role=NAME:M=m,V=v,P=p,other=o   define a role's cost multipliers (VIDEO, MUSIC built in)
+ *   --health-interval=SEC             TCP connect probe period (default 2, 0 = off), --health-timeout=SEC,
+ *   --health-fall=N --health-rise=N   failures that eject a backend, passing probes that reinstate it
+ *   --connect-timeout=SEC             upstream connect deadline (default 1, 0 = none)
+ *   --io-timeout=SEC                  longest silence on a socket that owes data (default 60, 0 = none);
+ *                                     a request that fails before its first reply byte moves once to
+ *                                     the next‑best backend
+ *   --max-wait=SEC --max-active=N     shed a request whose backend's projected wait exceeds SEC, or
+ *   --max-inflight=N                  that already runs N requests, or when N are active in total
+ *   --shed=rst|reply                  how: reset the connection, or reply "ER" and close (default rst)
+ *   --queue=srpt|fifo                 order of requests waiting for a backend connection (default srpt:
+ *   --queue-aging=A --deadline=T=SEC  shortest expected first, aged by A per second waited, default 0.1;
+ *                                     a type's deadline caps the estimate it is ranked by)
+ *   --peer=IP:PORT                    share backend load with another LB in front of the same backends
+ *   --cluster-port=PORT               (repeatable), over UDP from PORT (default: any) every
+ *   --gossip-interval=SEC             SEC (default 0.05)
+ *   --max-backends=N                  backend slots, so a reload can add backends (default: as configured)
+ *   --trace=N                         per-request trace events kept per thread (default 16384, 0 = off);
+ *                                     GET /trace on --metrics-port dumps them as Chrome trace JSON
+ *   --nodelay=0|1 --quickack          socket tuning for clients and upstreams (see "socket tuning"):
+ *   --fastopen=QLEN --busy-poll=USEC  TCP_NODELAY (default on), TCP_QUICKACK, TCP Fast Open,
+ *   --sndbuf=BYTES --rcvbuf=BYTES     SO_BUSY_POLL, socket buffer sizes (0 = kernel default)
+ *   --drain-timeout=SEC               after an upgrade, longest the old process serves its clients (default 30)
+ *   --cache-ttl=SEC --no-cache=TYPES  answer repeated (type, base) requests from an LB‑side reply cache for
+ *   --cache-entries=N                 SEC (default 0 = off), except TYPES (e.g. P or M,P); at most N entries
+ *   --cache-bytes=BYTES               (default 1024) and BYTES of replies (default 1 MiB); see cache.h
+ *
+ *   SIGHUP reloads the backend list (--config files and --backend options),
+ *   SIGUSR2 starts a new process from the same command on the listening
+ *   sockets and lets this one drain (see "reload and upgrade").
  */
 
 #include <arpa/inet.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <csignal>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+#include "cache.h"
+#include "coro.h"
+#include "metrics.h"
+#include "sched.h"
+#include "slab.h"
+#include "trace.h"
+#include "uring.h"
+#include "workq.h"
+
 using Steady = std::chrono::steady_clock;
 
+/* -DLB_ALLOC_DEBUG counts operator new calls per thread and, once a thread
+ * has served ALLOC_WARMUP requests (pools grown, queues at their high‑water
+ * mark), aborts if a later request on it allocated at all.  Connection pool
+ * growth after warm‑up (a reconnect past --pool-idle) is an allocation too,
+ * as is a new peak of concurrent clients past what the slabs hold (epoll
+ * prefills SLAB_PREFILL; coro frames are only pooled once they exist). */
+#ifdef LB_ALLOC_DEBUG
+static thread_local uint64_t thread_allocs = 0;
+void* operator new(size_t n) { ++thread_allocs; if (void* p = std::malloc(n ? n : 1)) return p; throw std::bad_alloc(); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }     // noinline: else GCC flags new/free as mismatched
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+static const uint64_t ALLOC_WARMUP = 1000;
+static void alloc_check() {
+    static thread_local uint64_t served = 0, base = 0;
+    if (++served == ALLOC_WARMUP) base = thread_allocs;
+    else if (served > ALLOC_WARMUP && thread_allocs != base) { std::fprintf(stderr, "[LB] request %llu allocated %llu times\n", (unsigned long long)served, (unsigned long long)(thread_allocs - base)); std::abort(); }
+}
+#else
+static void alloc_check() {}
+#endif
+
+// Servers echo the 2‑byte request when done; replies are framed on --reply-len.
+static size_t reply_len = 2;
+static const size_t PIPE_CHUNK = 65536;     // default pipe capacity
+
+/* One pooled upstream connection.  With pipelining several requests share it:
+ * writers take a ticket under io, replies come back in ticket order and the
+ * holder of the oldest outstanding ticket reads the next one. */
+struct UpConn {
+    int fd = -1;
+    size_t inflight = 0;                // Backend::mtx
+    Steady::time_point last_used;       // Backend::mtx
+    std::mutex io;
+    std::condition_variable turn;
+    uint64_t next_send = 0, next_recv = 0;   // io
+    Steady::time_point last_reply;           // io; a pipelined reply's service starts here at the earliest
+    std::atomic<bool> broken{false};
+};
+
+// A threads‑engine checkout blocked on a full pool, handed a connection by pool_handoff.
+struct PoolWaiter { std::condition_variable cv; UpConn* got = nullptr; };
+
+/* A backend slot's place in reloads: LIVE takes new requests, DRAINING was
+ * removed and still finishes what it has, GONE has finished (its slot is
+ * kept, should the backend come back, until a reload needs it for another
+ * once its connections are closed), VACANT has never been used. */
+enum BackendState : uint8_t { B_LIVE, B_DRAINING, B_GONE, B_VACANT };
+
 struct Backend {
-    enum Role { VIDEO, MUSIC } role;
+    Role role;
     std::string ip;
     uint16_t port;
-    int fd;
-    std::mutex mtx;
-    double vfinish;
+    sockaddr_in addr{};                 // resolved once, reused by every connect
+    std::mutex mtx;                     // guards the connection pool
+    WaitQueue<PoolWaiter*> waiters;     // blocked checkouts, best queue rank first
+    std::vector<std::unique_ptr<UpConn>> conns;   // grows lazily up to pool_max
+    size_t pool_max;                    // also the concurrency SERPT assumes
+    uint32_t weight = 1;                // wrr share
+    std::atomic<int> fails{0}, rises{0}, req_fails{0};  // consecutive failed / passing probes, failed requests
+    std::atomic<uint8_t> state{B_LIVE};                 // BackendState; role, ip and addr are set before it turns LIVE
+    std::atomic<int> open{0};                           // upstream connections to it, pooled or busy, in any engine
 
-    Backend(Role r, const std::string& ip_, uint16_t p)
-        : role(r), ip(ip_), port(p), fd(-1), vfinish(0) {}
+    Backend(Role r, const std::string& ip_, uint16_t p, size_t pool = 1)
+        : role(r), ip(ip_), port(p), pool_max(pool) { addr.sin_family = AF_INET; addr.sin_port = htons(p); inet_pton(AF_INET, ip.c_str(), &addr.sin_addr); }
 
     Backend(const Backend&) = delete;
     Backend& operator=(const Backend&) = delete;
-    Backend(Backend&& other) noexcept : role(other.role), ip(std::move(other.ip)), port(other.port), fd(other.fd), vfinish(other.vfinish) { other.fd = -1; }
+    Backend(Backend&& other) noexcept : role(other.role), ip(std::move(other.ip)), port(other.port), addr(other.addr), conns(std::move(other.conns)), pool_max(other.pool_max), weight(other.weight), state(other.state.load()) {}
     Backend& operator=(Backend&&) = delete;
 };
 
@@ -45,48 +183,2059 @@ static ssize_t write_n(int fd, const void* buf, size_t n) {
     while (left) { ssize_t w = send(fd, p, left, 0); if (w <= 0) return w; left -= w; p += w; }
     return n;
 }
-static int connect_once(const std::string& ip, uint16_t port) {
-    int s = socket(AF_INET, SOCK_STREAM, 0); if (s < 0) return -1;
-    sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons(port); inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
-    if (connect(s, (sockaddr*)&addr, sizeof(addr)) < 0) { close(s); return -1; }
+
+// RELAY_RETRY: the upstream failed before any reply byte, so the request can be re‑dispatched.
+enum Relay { RELAY_OK, RELAY_CLIENT, RELAY_RETRY, RELAY_UPSTREAM };
+
+/* Streams n reply bytes from `from` to `to` through this thread's pipe, so they
+ * never cross userspace; falls back to a buffered loop where splice() is not
+ * supported.  If the client goes away the rest is still read off `from` to
+ * keep the upstream framed.  `first` is when the first byte arrived, traced
+ * for request `trace` on backend `b`.  With `copy` the reply is also
+ * appended there for the reply cache, so it goes through userspace. */
+static void trace(TraceKind k, uint32_t id, size_t backend = 0);
+static int relay_n(int from, int to, size_t n, Steady::time_point& first, uint32_t trace_id, size_t b, std::string* copy) {
+    static thread_local int p[2] = { -1, -1 }; static thread_local bool tried = false;
+    if (!tried) { tried = true; if (pipe2(p, O_CLOEXEC) < 0) p[0] = p[1] = -1; }
+    char buf[16384]; bool client_ok = true; size_t left = n;
+    while (left) {
+        ssize_t k;
+        if (p[0] != -1 && client_ok && !copy) {
+            k = splice(from, nullptr, p[1], nullptr, std::min(left, PIPE_CHUNK), SPLICE_F_MOVE);
+            if (k < 0 && errno == EINVAL) { close(p[0]); close(p[1]); p[0] = p[1] = -1; continue; }
+            if (k <= 0) return left == n ? RELAY_RETRY : RELAY_UPSTREAM;
+            if (left == n) { first = Steady::now(); trace(TR_FIRST_BYTE, trace_id, b); }
+            for (ssize_t out = k; out > 0;) {
+                ssize_t w = splice(p[0], nullptr, to, nullptr, out, SPLICE_F_MOVE);
+                if (w > 0) { out -= w; continue; }
+                client_ok = false;
+                while (out > 0) { ssize_t d = read(p[0], buf, std::min<size_t>(out, sizeof(buf))); if (d <= 0) return RELAY_UPSTREAM; out -= d; }
+            }
+        } else {
+            k = recv(from, buf, std::min(left, sizeof(buf)), 0); if (k <= 0) return left == n ? RELAY_RETRY : RELAY_UPSTREAM;
+            if (left == n) { first = Steady::now(); trace(TR_FIRST_BYTE, trace_id, b); }
+            if (copy) copy->append(buf, size_t(k));
+            if (client_ok && write_n(to, buf, k) != k) client_ok = false;
+        }
+        left -= k;
+    }
+    return client_ok ? RELAY_OK : RELAY_CLIENT;
+}
+static double connect_timeout_s = 1, io_timeout_s = 60;
+
+// connect() on a non‑blocking socket, waiting at most timeout_s (<= 0: no limit).
+static bool connect_within(int s, const sockaddr_in& addr, double timeout_s) {
+    if (connect(s, (const sockaddr*)&addr, sizeof(addr)) == 0) return true;
+    if (errno != EINPROGRESS) return false;
+    pollfd p{ s, POLLOUT, 0 }; int rc, err = 0; socklen_t len = sizeof(err);
+    do rc = poll(&p, 1, timeout_s > 0 ? int(timeout_s * 1000) : -1); while (rc < 0 && errno == EINTR);
+    if (rc == 0) { errno = ETIMEDOUT; return false; }
+    return rc == 1 && getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && !err;
+}
+// Blocking reads and writes on fd give up (EAGAIN) after --io-timeout of silence.
+static void set_io_timeout(int fd) {
+    if (io_timeout_s <= 0) return;
+    timeval tv{ time_t(io_timeout_s), suseconds_t((io_timeout_s - double(time_t(io_timeout_s))) * 1e6) };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)); setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* ───────────── socket tuning ─────────────
+ * Every request is a 2‑byte write answered by a small reply, the pattern
+ * Nagle and delayed ACKs hurt most: with Nagle a request pipelined or kept
+ * alive behind an unacknowledged one waits for that ACK, which the peer
+ * may delay by up to 40 ms.  tune_listener() sets the listening sockets up
+ * and accepted clients inherit it (Linux copies TCP_NODELAY, SO_BUSY_POLL
+ * and the buffer sizes); tune_upstream() does the same for each upstream
+ * before it connects, and adds TCP_FASTOPEN_CONNECT, so the first request
+ * rides on the SYN once the backend has handed out a cookie (a dead backend
+ * then fails at that first write, not at connect).  TCP_QUICKACK is not
+ * inherited and the kernel drops it again when it leaves quickack mode, so
+ * tune_client() sets it on each accepted client: it speeds up the ACKs of
+ * a connection's first exchanges.  Failures are reported once per option. */
+struct SockTuning { bool nodelay = true, quickack = false; int fastopen = 0, busy_poll_us = 0, sndbuf = 0, rcvbuf = 0; };
+static SockTuning tuning;
+
+static void sock_opt(int fd, int level, int opt, int v, const char* what) {
+    static std::atomic<uint32_t> warned{0};
+    if (setsockopt(fd, level, opt, &v, sizeof(v)) == 0) return;
+    uint32_t bit = 1u << (uint32_t(opt) % 32);
+    if (!(warned.fetch_or(bit) & bit)) std::cerr << "[LB] cannot set " << what << ": " << strerror(errno) << "\n";
+}
+static void tune_common(int fd) {
+    if (tuning.nodelay) sock_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (tuning.busy_poll_us > 0) sock_opt(fd, SOL_SOCKET, SO_BUSY_POLL, tuning.busy_poll_us, "SO_BUSY_POLL");
+    if (tuning.sndbuf > 0) sock_opt(fd, SOL_SOCKET, SO_SNDBUF, tuning.sndbuf, "SO_SNDBUF");
+    if (tuning.rcvbuf > 0) sock_opt(fd, SOL_SOCKET, SO_RCVBUF, tuning.rcvbuf, "SO_RCVBUF");
+}
+static void tune_listener(int fd) { tune_common(fd); if (tuning.fastopen > 0) sock_opt(fd, IPPROTO_TCP, TCP_FASTOPEN, tuning.fastopen, "TCP_FASTOPEN"); }
+static void tune_upstream(int fd) {
+    tune_common(fd);
+    if (tuning.quickack) sock_opt(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+    if (tuning.fastopen > 0) sock_opt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, "TCP_FASTOPEN_CONNECT");
+}
+static void tune_client(int fd) { if (tuning.quickack) sock_opt(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK"); }
+
+static int connect_once(const sockaddr_in& addr) {
+    int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0); if (s < 0) return -1;
+    tune_upstream(s);
+    if (!connect_within(s, addr, connect_timeout_s)) { close(s); return -1; }
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) & ~O_NONBLOCK); set_io_timeout(s);
     return s;
 }
 
+/* ───────────── thread placement ─────────────
+ * --cpus=CLASS:LIST runs a class of threads on a CPU set: LIST is CPU
+ * numbers and ranges ("0-3,8"), NUMA nodes ("node1", their cpulist from
+ * sysfs), both, or "all".  Reactors and acceptors are pinned one to a CPU,
+ * thread i to the i‑th CPU of the list; workers, the health checker, the
+ * metrics exporter and the aux threads (control, pool reaper, gossip) may
+ * run anywhere in theirs.  A pinned reactor or acceptor that has listeners
+ * of its own sets SO_INCOMING_CPU on them, so SO_REUSEPORT hands it the
+ * connections whose packets its core receives, and each connection is
+ * accepted, served and relayed on one core.  Reactors allocate their state
+ * after they are placed, so first touch puts it on their node; metric
+ * shards are split between nodes (see Metrics::shard).  A class left out
+ * keeps the affinity the process started with, also in threads a placed
+ * one starts.  --pin is --cpus=reactor:all --cpus=acceptor:all.
+ *
+ * The scheduler table stays one copy for all nodes: a pick has to see every
+ * charge at once, and replicas would need the cluster section's merging. */
+enum ThreadClass { TC_REACTOR, TC_ACCEPTOR, TC_WORKER, TC_HEALTH, TC_METRICS, TC_AUX, THREAD_CLASSES };
+static const char* const THREAD_CLASS_NAMES[THREAD_CLASSES] = { "reactor", "acceptor", "worker", "health", "metrics", "aux" };
+static std::vector<int> class_cpus[THREAD_CLASSES];
+static bool placing = false;                    // some class has CPUs
+static cpu_set_t startup_cpus;                  // the process's affinity before any placement
+
+// "0-3,8", "node1", "node0,12-15" or "all" into CPU numbers; false if malformed or naming none.
+static bool parse_cpus(const std::string& list, std::vector<int>& out) {
+    std::stringstream ss(list); std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item == "all") { for (int c = 0; c < CPU_SETSIZE; ++c) if (CPU_ISSET(c, &startup_cpus)) out.push_back(c); continue; }
+        if (item.compare(0, 4, "node") == 0) {
+            std::ifstream f("/sys/devices/system/node/" + item + "/cpulist"); std::string cpus;
+            if (!std::getline(f, cpus) || !parse_cpus(cpus, out)) return false;
+            continue;
+        }
+        char* end; long lo = std::strtol(item.c_str(), &end, 10), hi = lo;
+        if (end == item.c_str()) return false;
+        if (*end == '-') { const char* p = end + 1; hi = std::strtol(p, &end, 10); if (end == p) return false; }
+        if (*end || lo < 0 || hi < lo || hi >= CPU_SETSIZE) return false;
+        for (long c = lo; c <= hi; ++c) out.push_back(int(c));
+    }
+    return !out.empty();
+}
+// Node ids run up to the last one online (sysfs uses the same list syntax).
+static int numa_nodes() {
+    std::ifstream f("/sys/devices/system/node/online"); std::string list; std::vector<int> ids;
+    if (!std::getline(f, list) || !parse_cpus(list, ids)) return 1;
+    return *std::max_element(ids.begin(), ids.end()) + 1;
+}
+// Places and names the calling thread, the i‑th of its class (SIZE_MAX: the only one, or
+// one of many unnumbered); the CPU it is pinned to, or -1.
+static int place_thread(ThreadClass c, size_t i = SIZE_MAX) {
+    char name[32];
+    if (i == SIZE_MAX) std::snprintf(name, sizeof(name), "lb-%s", THREAD_CLASS_NAMES[c]); else std::snprintf(name, sizeof(name), "lb-%s%zu", THREAD_CLASS_NAMES[c], i);
+    name[15] = 0;                               // the kernel keeps 15
+    pthread_setname_np(pthread_self(), name);
+    if (!placing) return -1;
+    const std::vector<int>& cpus = class_cpus[c];
+    cpu_set_t set = startup_cpus; int pinned = -1;
+    if (!cpus.empty() && (c == TC_REACTOR || c == TC_ACCEPTOR)) { pinned = cpus[(i == SIZE_MAX ? 0 : i) % cpus.size()]; CPU_ZERO(&set); CPU_SET(pinned, &set); }
+    else if (!cpus.empty()) { CPU_ZERO(&set); for (int cpu : cpus) CPU_SET(cpu, &set); }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) { std::cerr << "[LB] cannot place " << name << ": " << strerror(errno) << "\n"; return -1; }
+    return pinned;
+}
+// A pinned thread's own listeners take the connections that arrive on its CPU.
+static void steer_listener(int fd, int cpu) {
+#ifdef SO_INCOMING_CPU
+    if (cpu >= 0) sock_opt(fd, SOL_SOCKET, SO_INCOMING_CPU, cpu, "SO_INCOMING_CPU");
+#endif
+}
+
 static std::vector<Backend> backends;
-static std::mutex sched_mtx;
+static SchedTable sched;
+static Metrics metrics;
+static Tracer tracer;
+static ReplyCache cache;
+static void trace(TraceKind k, uint32_t id, size_t backend) { tracer.record(k, id, backend); }
+static uint32_t trace_start(TraceKind k) { uint32_t id = tracer.new_id(); trace(k, id); return id; }
+// A parsed request's trace id: its connection's for the first one on it (so accept → parse shows), else a new one.
+static uint32_t trace_request(uint32_t& conn) { uint32_t id = conn ? conn : tracer.new_id(); conn = 0; trace(TR_PARSED, id); return id; }
 static Steady::time_point start_ts;
+static size_t pool_max = 1;
+static double pool_idle_s = 30;
+static size_t pipeline_depth = 1;
+static size_t keepalive = 0;                // requests in flight per client connection, 0 = one per connection
+static size_t client_window() { return keepalive ? keepalive : 1; }
 
-static double now_seconds() { return std::chrono::duration<double>(Steady::now() - start_ts).count(); }
+static vtime_t now_ticks() { return std::chrono::duration_cast<std::chrono::microseconds>(Steady::now() - start_ts).count(); }
+static bool backend_live(size_t i) { return backends[i].state.load(std::memory_order_acquire) == B_LIVE; }
+// Set once a new process has taken over the listening sockets (see "reload and upgrade").
+static std::atomic<bool> upgrading{false};
+static std::atomic<int> acceptors_running{0};      // acceptor threads or reactors that still accept
 
-static int multiplier(char t, Backend::Role r) {
-    if (r == Backend::VIDEO) return t=='M'?2:1;
-    // MUSIC server
-    if (t=='M') return 1; if (t=='V') return 3; return 2;
+/* ───────────── health checks ─────────────
+ * A checker thread TCP‑connects to every backend each --health-interval.
+ * --health-fall consecutive failed probes eject it, and so do as many
+ * consecutive failed requests (connect failures, timeouts), so a dead server
+ * is caught without waiting for a probe and a stalled one that still accepts
+ * connections is caught at all.  --health-rise consecutive passing probes
+ * reinstate it.  While down, SchedTable ranks it last, so it only gets
+ * traffic if everything is down. */
+static double health_interval_s = 2, health_timeout_s = 1;
+static int health_fall = 3, health_rise = 2;
+
+static void health_eject(size_t i) {
+    if (health_interval_s <= 0 || !sched.up(i)) return;      // nothing would reinstate it
+    sched.set_down(i, true, now_ticks()); std::cerr << "[LB] backend " << backends[i].ip << ":" << backends[i].port << " down\n";
+}
+static void health_result(size_t i, bool ok) {
+    Backend& b = backends[i];
+    if (ok) {
+        b.fails = 0;
+        if (!sched.up(i) && ++b.rises >= health_rise) { b.rises = 0; b.req_fails = 0; sched.set_down(i, false, now_ticks()); std::cerr << "[LB] backend " << b.ip << ":" << b.port << " up\n"; }
+        return;
+    }
+    b.rises = 0;
+    if (++b.fails >= health_fall) health_eject(i);
 }
+// Request path: a failure that is the backend's fault, and a reply that proves it is serving.
+static void health_fail(size_t i) { if (++backends[i].req_fails >= health_fall) health_eject(i); }
+static void health_pass(size_t i) { if (backends[i].req_fails.load(std::memory_order_relaxed)) backends[i].req_fails.store(0, std::memory_order_relaxed); }
+static void backend_timeout(size_t i) { std::cerr << "[LB] backend " << backends[i].ip << ":" << backends[i].port << " timed out\n"; health_fail(i); }
 
-static size_t pick_backend(char type, int base) {
-    std::lock_guard<std::mutex> g(sched_mtx);
-    double tnow = now_seconds(), best = 1e100; size_t idx = 0;
-    for (size_t i=0;i<backends.size();++i) {
-        const Backend& b = backends[i]; double dur = multiplier(type,b.role)*base; double v = (b.vfinish<tnow?tnow:b.vfinish)+dur;
-        if (v<best){best=v; idx=i;}
+static bool health_probe(const Backend& b) {
+    int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0); if (s < 0) return false;
+    bool ok = connect_within(s, b.addr, health_timeout_s);
+    close(s); return ok;
+}
+static void health_checker() {
+    place_thread(TC_HEALTH);
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(health_interval_s));
+        for (size_t i = 0; i < backends.size(); ++i) if (backend_live(i)) health_result(i, health_probe(backends[i]));
     }
-    backends[idx].vfinish = best; return idx;
 }
-static bool ensure_connected(Backend& b) {
-    if (b.fd!=-1) return true; b.fd=connect_once(b.ip,b.port); if(b.fd==-1){std::cerr<<"[LB] cannot connect to "<<b.ip<<":"<<b.port<<"\n";return false;} return true; }
 
-static void handle_client(int cfd) {
-    char req[2]; if(read_n(cfd,req,2)!=2){close(cfd);return;} char type=req[0]; int base=req[1]-'0'; if(base<=0||base>9){close(cfd);return;}
-    size_t idx=pick_backend(type,base); Backend& b=backends[idx]; if(!ensure_connected(b)){close(cfd);return;}
+/* ───────────── admission control ─────────────
+ * pick_backend refuses (SIZE_MAX) a request that would wait longer than
+ * --max-wait behind its backend's projected backlog, land on a backend
+ * already running --max-active, or exceed --max-inflight overall; the charge
+ * is taken back and the engine sheds the client.  Checks are racy by design:
+ * concurrent pickers can overshoot a limit by one request each. */
+static vtime_t max_wait = 0;                    // ticks; 0 = no limit
+static uint32_t max_active = 0, max_inflight = 0;
+static bool shed_reply = false;
+static const char SHED_REPLY[2] = { 'E', 'R' };
+
+// Answers a refused request before the caller closes fd: a 2‑byte "ER", or a RST instead of a FIN.
+static void shed(int fd) {
+    if (shed_reply) { if (send(fd, SHED_REPLY, 2, MSG_NOSIGNAL | MSG_DONTWAIT) == 2) return; }
+    linger l{ 1, 0 }; setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+}
+
+// est: the request's ticket, the service time its backend was charged for (see SchedTable::settle).
+template <class P> static size_t pick_backend(char type, int base, vtime_t& est) {
+    if (max_inflight && sched.total.load(std::memory_order_relaxed) >= max_inflight) { metrics.count(GC_SHED); return SIZE_MAX; }
+    vtime_t now = now_ticks(); size_t i = P::pick(sched, type, base, now); est = sched.cost(type, base, i);
+    if ((max_active && sched.s[i].active.load(std::memory_order_relaxed) >= max_active) ||
+        (max_wait && sched.vfinish[i].load(std::memory_order_relaxed) - est/sched.s[i].slots - now > max_wait)) {
+        sched.cancel(i, est, now); metrics.count(GC_SHED); return SIZE_MAX;
+    }
+    sched.begin(i); metrics.count(i, BC_REQUESTS); return i;
+}
+
+/* A request whose backend failed before any reply byte reached the client is
+ * re‑dispatched once: its ticket on the failed backend is cancelled and
+ * counted as a failure, and the request goes to the policy's pick, or the
+ * next‑best backend if that is the failed one again, with a new ticket. */
+template <class P> static size_t retry_backend(char type, int base, size_t failed, vtime_t& est) {
+    vtime_t now = now_ticks();
+    sched.cancel(failed, est, now); sched.done(failed); metrics.count(failed, BC_FAILURES);
+    size_t i = P::pick(sched, type, base, now);
+    if (i == failed) { sched.cancel(i, sched.cost(type, base, i), now); i = sched.pick_excluding(type, base, now, failed); }
+    est = sched.cost(type, base, i); sched.begin(i); metrics.count(i, BC_REQUESTS); return i;
+}
+static size_t (*redispatch)(char type, int base, size_t failed, vtime_t& est) = nullptr;   // retry_backend<P> of the running policy
+
+/* ───────────── connection pool ─────────────
+ * checkout prefers an idle connection, then grows the pool through
+ * connect_once up to pool_max, then pipelines onto the least loaded one
+ * (if --pipeline allows) and otherwise queues at `rank` (see QueueOrder)
+ * until a checkin hands it a connection, or for at most wait_ms (-1: no
+ * limit) after which it sets *busy and gives up.  While anyone queues, a
+ * new checkout queues too, so the best‑ranked waiter always goes next. */
+// Under b.mtx: gives c to the best‑ranked waiter if c can take a request (or be reconnected).
+static void pool_handoff(Backend& b, UpConn* c) {
+    bool usable = c->fd == -1 ? !c->inflight : !c->broken && c->inflight < pipeline_depth;
+    if (!usable || b.waiters.empty()) return;
+    PoolWaiter* w = b.waiters.top(); b.waiters.pop();
+    ++c->inflight; w->got = c; w->cv.notify_one();
+}
+static UpConn* pool_checkout(Backend& b, vtime_t rank, int wait_ms = -1, bool* busy = nullptr, uint32_t trace_id = 0) {
+    static thread_local PoolWaiter me;
+    size_t i = size_t(&b - &backends[0]);
+    std::unique_lock<std::mutex> g(b.mtx); trace(TR_LOCKED, trace_id, i);
+    UpConn* c = nullptr;
+    if (b.waiters.empty()) {
+        UpConn *idle = nullptr, *spare = nullptr, *shared = nullptr;
+        for (auto& p : b.conns) {
+            UpConn& x = *p;
+            if (x.fd == -1) { if (!x.inflight && !spare) spare = &x; }     // inflight here means connecting
+            else if (!x.inflight) { if (!idle || x.last_used > idle->last_used) idle = &x; }
+            else if (x.inflight < pipeline_depth && !x.broken && (!shared || x.inflight < shared->inflight)) shared = &x;
+        }
+        if (!idle && !spare && b.conns.size() < b.pool_max) { b.conns.emplace_back(new UpConn); spare = b.conns.back().get(); }
+        c = idle ? idle : spare ? spare : shared;
+        if (c) ++c->inflight;
+    }
+    if (!c) {
+        if (!sched.up(i)) return nullptr;     // ejected: re‑dispatch
+        if (!wait_ms) { *busy = true; return nullptr; }
+        me.got = nullptr; b.waiters.push(&me, rank);
+        auto handed = [&] { return me.got != nullptr; };
+        if (wait_ms < 0) me.cv.wait(g, handed);
+        else if (!me.cv.wait_for(g, std::chrono::milliseconds(wait_ms), handed)) { b.waiters.erase(&me); *busy = true; return nullptr; }
+        c = me.got;
+        if (!sched.up(i)) { --c->inflight; pool_handoff(b, c); return nullptr; }     // ejected while we queued
+    }
+    trace(TR_CHECKOUT, trace_id, i);
+    if (c->fd != -1) return c;
+    g.unlock();
+    int fd = connect_once(b.addr);
+    g.lock();
+    if (fd == -1) { std::cerr<<"[LB] cannot connect to "<<b.ip<<":"<<b.port<<"\n"; --c->inflight; pool_handoff(b, c); health_fail(i); return nullptr; }
+    metrics.count(i, BC_CONNECTS); trace(TR_CONNECTED, trace_id, i);
+    c->fd = fd; c->next_send = c->next_recv = 0; c->broken = false; ++b.open;
+    return c;
+}
+static void pool_checkin(Backend& b, UpConn* c) {
     std::lock_guard<std::mutex> g(b.mtx);
-    if(write_n(b.fd,req,2)!=2){close(b.fd);b.fd=-1;close(cfd);return;}
-    char resp[1024]; ssize_t n=recv(b.fd,resp,sizeof(resp),0); if(n>0) write_n(cfd,resp,n); else {close(b.fd);b.fd=-1;}
-    close(cfd);
+    c->last_used = Steady::now();
+    if (--c->inflight == 0 && c->broken) { close(c->fd); c->fd = -1; --b.open; }
+    pool_handoff(b, c);
+}
+static vtime_t to_ticks(Steady::duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); }
+// Where a request that arrived at `at` queues for its backend's connections.
+static vtime_t queue_rank(char type, vtime_t est, Steady::time_point at) { return sched.order.rank(type, est, to_ticks(at - start_ts)); }
+
+// Sends one request on c; seq is its place in the reply order when pipelined, t0 when it went.
+static int pool_send(UpConn& c, const char* req, uint64_t& seq, Steady::time_point& t0) {
+    if (pipeline_depth == 1) { t0 = Steady::now(); if (write_n(c.fd, req, 2) != 2) { c.broken = true; return RELAY_RETRY; } return RELAY_OK; }
+    std::lock_guard<std::mutex> g(c.io);
+    if (c.broken) return RELAY_RETRY;
+    seq = c.next_send++; t0 = Steady::now();
+    if (write_n(c.fd, req, 2) != 2) { c.broken = true; c.turn.notify_all(); return RELAY_RETRY; }
+    return RELAY_OK;
+}
+// Relays the reply to what pool_send put on c to cfd, in ticket order when pipelined
+// (and into copy, if not null).
+// `took` is the backend's share of the wait: from when the request was sent,
+// or when the reply ahead of it on the connection started, to its first byte.
+static int pool_recv(UpConn& c, uint64_t seq, Steady::time_point t0, int cfd, vtime_t& took, uint32_t trace_id, size_t b, std::string* copy) {
+    Steady::time_point first;
+    if (pipeline_depth == 1) {
+        int rc = relay_n(c.fd, cfd, reply_len, first, trace_id, b, copy); if (rc >= RELAY_RETRY) c.broken = true;
+        took = to_ticks(first - t0); return rc;
+    }
+    std::unique_lock<std::mutex> g(c.io);
+    c.turn.wait(g, [&]{ return c.next_recv == seq || c.broken; });
+    if (c.broken) return RELAY_RETRY;
+    if (c.last_reply > t0) t0 = c.last_reply;
+    g.unlock();
+    int rc = relay_n(c.fd, cfd, reply_len, first, trace_id, b, copy);
+    g.lock(); c.last_reply = first; took = to_ticks(first - t0);
+    ++c.next_recv; if (rc >= RELAY_RETRY) c.broken = true; c.turn.notify_all();
+    return c.broken && rc < RELAY_RETRY ? RELAY_UPSTREAM : rc;
+}
+// Closes connections idle past --pool-idle, and any idle one to a backend a reload removed.
+static Steady::time_point idle_cutoff(size_t i, Steady::time_point now) {
+    if (!backend_live(i)) return Steady::time_point::max();
+    return pool_idle_s > 0 ? now - std::chrono::duration_cast<Steady::duration>(std::chrono::duration<double>(pool_idle_s)) : Steady::time_point::min();
+}
+static void pool_reaper() {
+    place_thread(TC_AUX);
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        Steady::time_point now = Steady::now();
+        for (size_t i = 0; i < backends.size(); ++i) {
+            Backend& b = backends[i]; Steady::time_point cutoff = idle_cutoff(i, now);
+            std::lock_guard<std::mutex> g(b.mtx);
+            for (auto& p : b.conns) if (p->fd != -1 && !p->inflight && p->last_used < cutoff) { close(p->fd); p->fd = -1; --b.open; }
+        }
+    }
+}
+
+/* A threads‑engine client sends one request, or with --keepalive a stream of
+ * them.  Requests already in the socket are taken in ahead, up to --keepalive,
+ * and each is scheduled and sent on its own as soon as its pool has a
+ * connection free, so they run in parallel across backends; replies are then
+ * relayed in request order.  A request that must wait for a connection holds
+ * back the ones after it.  A reply that was already waiting when its turn
+ * came has no service time to learn from and settles at its estimate.
+ * With --cache-ttl a request may be answered from the reply cache, or wait
+ * for another worker's fill of the same key.  Only the oldest request of a
+ * window may fill, so a fill never waits behind requests that wait on other
+ * fills; a follower gives up on its fill after --io-timeout, as a pool wait
+ * does, while later requests of its client hold connections. */
+struct Pending {
+    char req[2]; size_t idx; vtime_t est = 0; uint32_t trace = 0;
+    Steady::time_point parsed, sent; uint64_t seq = 0;
+    UpConn* c = nullptr; int rc = RELAY_RETRY; bool tried = false, late = false;    // tried: sent, with rc
+    CacheClaim cache = CACHE_NONE; uint32_t ticket = 0; std::string reply;         // reply: a hit's, or a fill's as it arrives
+};
+
+// Sends p now if its pool has a connection to spare without waiting; false if it has not.
+static bool pending_send(Pending& p, int wait_ms) {
+    bool busy = false; p.c = pool_checkout(backends[p.idx], queue_rank(p.req[0], p.est, p.parsed), wait_ms, &busy, p.trace);
+    if (busy) return false;
+    p.tried = true; errno = 0;
+    if (p.c) { p.rc = pool_send(*p.c, p.req, p.seq, p.sent); trace(TR_SENT, p.trace, p.idx); }
+    return true;
+}
+// p's reply relayed to `to` (-1: read and dropped), sending p first if that has not happened.
+static int pending_reply(Pending& p, int to, int wait_ms, vtime_t& took) {
+    Backend& b = backends[p.idx];
+    if (!p.tried && !pending_send(p, wait_ms)) return RELAY_RETRY;
+    if (!p.c) return RELAY_RETRY;
+    int rc = p.rc; char x;
+    bool timed = !p.late || (pipeline_depth == 1 && recv(p.c->fd, &x, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN);
+    if (rc == RELAY_OK) { errno = 0; rc = pool_recv(*p.c, p.seq, p.sent, to, took, p.trace, p.idx, p.cache == CACHE_FILL ? &p.reply : nullptr); }
+    if (!timed) took = -1;
+    if (rc >= RELAY_RETRY && errno == EAGAIN) backend_timeout(p.idx);
+    pool_checkin(b, p.c); p.c = nullptr;
+    return rc;
+}
+// Finishes the oldest request of a client; false if the client must not get any more replies.
+template <class P> static bool pending_finish(Pending& p, int to, bool more) {
+    // waiting on a pool while holding connections for later requests could close a cycle with
+    // another client doing the same; such a wait gives up after --io-timeout
+    int wait_ms = more && io_timeout_s > 0 ? int(io_timeout_s * 1000) : -1;
+    if (p.cache == CACHE_FOLLOW) {      // if its fill fails, the request goes to a backend of its own
+        if (cache.wait(ReplyCache::key(p.req[0], p.req[1]-'0'), p.ticket, p.reply, wait_ms)) p.cache = CACHE_HIT;
+        else { p.cache = CACHE_NONE; p.idx = pick_backend<P>(p.req[0], p.req[1]-'0', p.est); if (p.idx != SIZE_MAX) trace(TR_PICKED, p.trace, p.idx); }
+    }
+    if (p.cache == CACHE_HIT) { trace(TR_DONE, p.trace); return to != -1 && write_n(to, p.reply.data(), p.reply.size()) == ssize_t(p.reply.size()); }
+    if (p.idx == SIZE_MAX) { if (to != -1) shed(to); return shed_reply; }
+    vtime_t took = 0; int rc = pending_reply(p, to, wait_ms, took);
+    if (rc == RELAY_RETRY) {
+        p.idx = retry_backend<P>(p.req[0], p.req[1]-'0', p.idx, p.est); p.tried = p.late = false; p.reply.clear();
+        rc = pending_reply(p, to, wait_ms, took);
+    }
+    if (p.cache == CACHE_FILL) cache.finish(ReplyCache::key(p.req[0], p.req[1]-'0'), p.reply, rc < RELAY_RETRY && p.reply.size() == reply_len);
+    sched.done(p.idx);
+    if (rc < RELAY_RETRY) { if (took >= 0) { sched.observe(p.idx, p.req[0], p.req[1]-'0', took); sched.settle(p.idx, p.est, took, now_ticks()); } health_pass(p.idx); }
+    else sched.cancel(p.idx, p.est, now_ticks());
+    if (rc == RELAY_OK) { vtime_t total = to_ticks(Steady::now() - p.parsed); if (took < 0) took = total; metrics.latency(p.idx, p.req[0], total - took, took, total); }
+    else if (rc >= RELAY_RETRY) metrics.count(p.idx, BC_FAILURES);
+    trace(TR_DONE, p.trace, p.idx);
+    alloc_check();
+    return rc == RELAY_OK;
+}
+
+template <class P> static void handle_client(int cfd) {
+    set_io_timeout(cfd);
+    static thread_local Ring<Pending> win; win.clear();
+    bool reading = true; int to = cfd;    // to: -1 once the client is gone or its stream broken
+    uint32_t conn_trace = trace_start(TR_ACCEPT);     // taken by a worker, which may be after it waited in a deque
+    while (true) {
+        while (reading && win.size() < client_window()) {
+            char req[2];
+            if (!win.empty() && recv(cfd, req, 2, MSG_PEEK | MSG_DONTWAIT) != 2) break;    // only what is already here
+            if (read_n(cfd, req, 2) != 2) { reading = false; break; }
+            reading = keepalive > 0;
+            int base = req[1]-'0'; if (base<=0||base>9) { metrics.count(GC_BAD_REQUESTS); reading = false; break; }
+            win.push_back(Pending()); Pending& p = win.back();
+            p.req[0] = req[0]; p.req[1] = req[1]; p.parsed = Steady::now(); p.late = win.size() > 1; p.trace = trace_request(conn_trace);
+            if (cache.wants(req[0])) {
+                p.cache = cache.claim(ReplyCache::key(req[0], base), p.reply, p.ticket, win.size() == 1);
+                metrics.count(p.cache == CACHE_HIT ? GC_CACHE_HITS : p.cache == CACHE_FOLLOW ? GC_CACHE_COALESCED : GC_CACHE_MISSES);
+                if (p.cache == CACHE_HIT || p.cache == CACHE_FOLLOW) { p.idx = SIZE_MAX; continue; }     // nothing to send
+            }
+            p.idx = pick_backend<P>(req[0], base, p.est); if (p.idx != SIZE_MAX) trace(TR_PICKED, p.trace, p.idx);
+            else if (p.cache == CACHE_FILL) { cache.finish(ReplyCache::key(req[0], base), p.reply, false); p.cache = CACHE_NONE; }
+        }
+        if (win.empty()) break;
+        for (size_t k = 0; k < win.size(); ++k) if (win[k].idx != SIZE_MAX && !win[k].tried && !pending_send(win[k], 0)) break;
+        bool more = false; for (size_t k = 1; k < win.size(); ++k) more |= win[k].c != nullptr;
+        if (!pending_finish<P>(win.front(), to, more)) { to = -1; reading = false; }
+        win.pop_front();
+    }
+    close(cfd); metrics.count(GC_CLOSES);
+}
+
+/* ───────────── epoll engine ─────────────
+ * Each reactor owns an epoll set, shares the listening socket (EPOLLEXCLUSIVE)
+ * and keeps its own pool of upstream connections per backend.  A Client reads
+ * one request, or with --keepalive a stream of them, and each becomes a Conn
+ * that queues on its backend's pool by queue rank, then goes to an idle
+ * upstream, else a newly opened one up to the per‑reactor cap, else is
+ * pipelined behind the least loaded one (up to --pipeline).  Replies are
+ * matched to the upstream's in‑flight FIFO.  The reply a client is owed next
+ * is spliced through the upstream's pipe straight to it; bytes the client
+ * cannot take yet stay in the pipe and the upstream stops reading until they
+ * drain.  A reply that starts before the ones ahead of it is copied aside
+ * and sent in its turn.  An upstream that fails or misses a deadline
+ * re‑dispatches the requests it had not started answering.  With
+ * --policy=late a Conn has no backend until the end of the epoll batch in
+ * which some pool has room for it (see late_pump).  With --cache-ttl a
+ * request may be answered from the reply cache, or ride on a fetch of the
+ * same request already in flight on this reactor; that fetch's reply is
+ * always copied aside, so it is complete when it settles the waiting ones.
+ */
+struct EvSource { enum Kind { LISTEN, CLIENT, UPSTREAM } kind; explicit EvSource(Kind k) : kind(k) {} };
+
+struct Listener : EvSource { int fd; explicit Listener(int fd_) : EvSource(LISTEN), fd(fd_) {} };
+
+struct Upstream;
+struct Client;
+
+// One request of a client, and its reply.  Pooled per reactor (see Slab): reset() keeps early's buffer.
+struct Conn {
+    Client* cl = nullptr; char req[2];
+    size_t backend = SIZE_MAX;          // set while counted as active on a backend
+    vtime_t est = 0;                    // its ticket there
+    Steady::time_point parsed_at, sent_at;
+    uint32_t trace = 0;
+    Upstream* up = nullptr;             // relaying it while the client is not writable
+    std::string early; size_t early_off = 0;   // reply bytes copied aside until its turn
+    bool direct = false;                // reply goes straight to the client
+    bool retried = false, complete = false, failed = false, reset_client = false;   // failed: close the client on reaching it
+    CacheClaim cache = CACHE_NONE;      // FILL: fetches for the cache; FOLLOW: waits, linked into a FILL's followers
+    Conn *followers = nullptr, *next_follower = nullptr;
+    void reset(Client* c, const char* r) {
+        cl = c; req[0] = r[0]; req[1] = r[1]; backend = SIZE_MAX; est = 0; up = nullptr;
+        cache = CACHE_NONE; followers = next_follower = nullptr;
+        if (early.capacity() > EARLY_KEEP) std::string().swap(early); else early.clear();
+        early.reserve(std::min(reply_len, EARLY_KEEP));
+        early_off = 0; direct = retried = complete = failed = reset_client = false;
+    }
+    static constexpr size_t EARLY_KEEP = 65536;     // larger copied‑aside replies give their buffer back
+};
+
+struct Client : EvSource {
+    int fd = -1; char req[2]; size_t got = 0;
+    uint32_t trace = 0;                 // the connection's, until its first request takes it
+    Ring<Conn*> q;                      // in request order; the head's reply is owed next
+    uint32_t events = EPOLLIN;          // as registered
+    bool reading = true, want_out = false, dead = false, closed = false;   // dead: gone, replies are dropped
+    Client() : EvSource(CLIENT) {}
+    void reset(int fd_) { fd = fd_; got = 0; events = EPOLLIN; reading = true; want_out = dead = closed = false; q.reserve(client_window()); }
+};
+
+struct Upstream : EvSource {
+    size_t idx; int fd = -1; bool connecting = false;
+    Ring<Conn*> inflight;
+    std::string out; size_t out_off = 0;        // request bytes not yet written
+    int pipe[2] = { -1, -1 };                   // reply bytes read but not yet at the client
+    std::vector<char> hold; size_t hold_off = 0;        // the same without splice()
+    size_t rgot = 0, held = 0;                  // of the head reply: read so far, still buffered
+    vtime_t took = 0;                           // head reply's service time, to its first byte
+    Steady::time_point last_used;               // also the last reply's start, for service timing
+    Steady::time_point progress;                // connect started or bytes moved; deadlines count from here
+    explicit Upstream(size_t i) : EvSource(UPSTREAM), idx(i) {}
+};
+
+struct UpstreamPool {
+    std::vector<Upstream> conns;        // reserved up front: epoll holds pointers into it
+    WaitQueue<Conn*> waiting;           // best queue rank first
+};
+
+struct Reactor {
+    int epfd = -1;
+    std::vector<Listener> listeners;    // reserved up front: epoll holds pointers into it
+    std::vector<UpstreamPool> pools;
+    LateQueue<Conn*> late;              // --policy=late: requests not yet bound to a backend
+    std::vector<Conn*> filling;         // per cache key, the FILL in flight; empty without --cache-ttl
+    void (*dispatch)(Reactor&, Conn*) = nullptr;    // cl_dispatch of the running policy
+};
+
+static size_t reactor_pool_max = 1;
+
+static void ev_ctl(Reactor& r, int op, int fd, uint32_t events, EvSource* src) {
+    epoll_event ev{}; ev.events = events; ev.data.ptr = src;
+    if (epoll_ctl(r.epfd, op, fd, &ev) < 0 && op != EPOLL_CTL_DEL) perror("epoll_ctl");
+}
+
+// Ends c's claim on its backend: the ticket is settled against the observed
+// service time once answered, or cancelled (took < 0) if it never was.
+static void conn_release(Conn* c, vtime_t took = -1) {
+    if (c->backend == SIZE_MAX) return;
+    if (took < 0) sched.cancel(c->backend, c->est, now_ticks()); else sched.settle(c->backend, c->est, took, now_ticks());
+    sched.done(c->backend); c->backend = SIZE_MAX;
+}
+// Back to the slabs after the current epoll batch, which may still hold events or pointers for them.
+static thread_local std::vector<Conn*> retired;
+static thread_local std::vector<Client*> retired_clients;
+static thread_local Slab<Conn> conn_slab;
+static thread_local Slab<Client> client_slab;
+static const size_t SLAB_PREFILL = 64;      // clients, requests and pool waiters a reactor holds before anything grows
+
+static void cl_watch(Reactor& r, Client* cl) {
+    if (cl->fd == -1) return;
+    uint32_t ev = (cl->reading && cl->q.size() < client_window() ? uint32_t(EPOLLIN) : 0u) | (cl->want_out ? uint32_t(EPOLLOUT) : 0u);
+    if (ev != cl->events) { ev_ctl(r, EPOLL_CTL_MOD, cl->fd, ev, cl); cl->events = ev; }
+}
+// The client is gone: replies still in flight for it are read and dropped.
+static void cl_kill(Client* cl) {
+    cl->dead = true; cl->reading = false;
+    if (cl->fd != -1) { close(cl->fd); cl->fd = -1; }
+}
+static void cl_close(Client* cl) {
+    if (cl->closed) return;
+    cl->closed = true; if (cl->fd != -1) { close(cl->fd); cl->fd = -1; }
+    retired_clients.push_back(cl); metrics.count(GC_CLOSES);
+}
+// Sends what the client is owed, in request order, and closes it once nothing
+// more is owed or coming.
+static void cl_advance(Reactor& r, Client* cl) {
+    while (!cl->q.empty()) {
+        Conn* h = cl->q.front();
+        if (!cl->dead && h->failed) {           // the replies before it are out; this one never will be
+            if (h->reset_client) { linger l{ 1, 0 }; setsockopt(cl->fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l)); }
+            cl_kill(cl);
+        }
+        while (!cl->dead && h->early_off < h->early.size()) {
+            ssize_t w = send(cl->fd, h->early.data() + h->early_off, h->early.size() - h->early_off, MSG_NOSIGNAL);
+            if (w < 0 && errno == EAGAIN) { cl->want_out = true; cl_watch(r, cl); return; }
+            if (w <= 0) { cl_kill(cl); break; }
+            h->early_off += w;
+        }
+        if (!h->complete) return;               // the rest of it is still on its way
+        cl->q.pop_front(); retired.push_back(h);
+    }
+    if (cl->dead || !cl->reading) { cl_close(cl); return; }
+    cl_watch(r, cl);
+}
+// A FILL is over: its followers get its reply, or on failure are dispatched as requests of their own.
+static void cache_settle(Reactor& r, Conn* c, bool ok) {
+    if (c->cache != CACHE_FILL) return;
+    size_t k = ReplyCache::key(c->req[0], c->req[1] - '0');
+    c->cache = CACHE_NONE; r.filling[k] = nullptr;
+    if (ok) cache.put(k, c->early.data(), c->early.size());
+    for (Conn *f = std::exchange(c->followers, nullptr), *next; f; f = next) {
+        next = std::exchange(f->next_follower, nullptr); f->cache = CACHE_NONE;
+        if (ok) { f->early.assign(c->early); f->complete = true; trace(TR_DONE, f->trace); }
+        else r.dispatch(r, f);
+        cl_advance(r, f->cl);
+    }
+}
+// c is over without a reply: its client is closed when c's turn comes.
+static void conn_fail(Reactor& r, Conn* c, bool reset = false) {
+    cache_settle(r, c, false); conn_release(c); c->complete = c->failed = true; c->reset_client = reset; c->up = nullptr;
+    cl_advance(r, c->cl);
+}
+// c's client went away before c was sent.
+static void conn_drop(Reactor& r, Conn* c) { cache_settle(r, c, false); conn_release(c); c->complete = true; cl_advance(r, c->cl); }
+
+static void up_pump(Reactor& r, UpstreamPool& p);
+
+static void up_close(Upstream& u) {
+    if (u.fd != -1) { close(u.fd); u.fd = -1; --backends[u.idx].open; }
+    if (u.pipe[0] != -1) { close(u.pipe[0]); close(u.pipe[1]); u.pipe[0] = u.pipe[1] = -1; }   // drops anything held
+    u.connecting = false; u.out.clear(); u.out_off = u.rgot = u.held = u.hold_off = 0;
+}
+
+// Reads are off while a reply is held for a slow client; writes while requests are pending.
+static void up_arm(Reactor& r, Upstream& u) { ev_ctl(r, EPOLL_CTL_MOD, u.fd, (u.held ? 0u : uint32_t(EPOLLIN)) | (u.out_off < u.out.size() ? uint32_t(EPOLLOUT) : 0u), &u); }
+
+// A request its upstream never started answering goes once to another backend.
+static void conn_retry(Reactor& r, Conn* c) {
+    if (c->cl->dead) { conn_drop(r, c); return; }
+    if (c->retried || !redispatch) { metrics.count(c->backend, BC_FAILURES); conn_fail(r, c); return; }
+    c->retried = true; c->backend = redispatch(c->req[0], c->req[1] - '0', c->backend, c->est);
+    UpstreamPool& p = r.pools[c->backend]; p.waiting.push(c, queue_rank(c->req[0], c->est, c->parsed_at)); up_pump(r, p);
+}
+
+static void up_fail(Reactor& r, Upstream& u, bool connect_failed) {
+    UpstreamPool& p = r.pools[u.idx];
+    if (connect_failed) { const Backend& b = backends[u.idx]; std::cerr << "[LB] cannot connect to " << b.ip << ":" << b.port << "\n"; health_fail(u.idx); }
+    Ring<Conn*> lost; lost.swap(u.inflight);
+    if (u.rgot) { metrics.count(u.idx, BC_FAILURES); Conn* c = lost.front(); lost.pop_front(); conn_fail(r, c); }   // part of its reply is out
+    up_close(u);
+    bool live = false; for (const Upstream& x : p.conns) live |= x.fd != -1;
+    if ((connect_failed && !live) || !sched.up(u.idx)) { for (; !p.waiting.empty(); p.waiting.pop()) lost.push_back(p.waiting.top()); }   // backend down
+    for (size_t k = 0; k < lost.size(); ++k) conn_retry(r, lost[k]);
+    up_pump(r, p);
+}
+
+static bool up_flush(Reactor& r, Upstream& u) {
+    while (u.out_off < u.out.size()) {
+        ssize_t w = send(u.fd, u.out.data() + u.out_off, u.out.size() - u.out_off, MSG_NOSIGNAL);
+        if (w < 0 && errno == EAGAIN) { up_arm(r, u); return true; }
+        if (w <= 0) { up_fail(r, u, false); return false; }
+        u.out_off += w;
+    }
+    u.out.clear(); u.out_off = 0;
+    up_arm(r, u);
+    return true;
+}
+
+static bool up_open(Reactor& r, Upstream& u) {
+    const Backend& b = backends[u.idx];
+    int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0); if (s < 0) return false;
+    tune_upstream(s);
+    if (connect(s, (const sockaddr*)&b.addr, sizeof(b.addr)) < 0 && errno != EINPROGRESS) { close(s); return false; }
+    if (pipe2(u.pipe, O_NONBLOCK | O_CLOEXEC) < 0) { u.pipe[0] = u.pipe[1] = -1; u.hold.resize(16384); }
+    u.fd = s; u.connecting = true; u.progress = Steady::now(); ev_ctl(r, EPOLL_CTL_ADD, s, EPOLLOUT, &u); ++backends[u.idx].open;
+    metrics.count(u.idx, BC_CONNECTS);
+    return true;
+}
+
+static void up_pump(Reactor& r, UpstreamPool& p) {
+    while (!p.waiting.empty()) {
+        if (p.waiting.top()->cl->dead) { Conn* c = p.waiting.top(); p.waiting.pop(); conn_drop(r, c); continue; }
+        Upstream *idle = nullptr, *spare = nullptr, *shared = nullptr; size_t connecting = 0;
+        for (Upstream& x : p.conns) {
+            if (x.connecting) ++connecting;
+            else if (x.fd == -1) { if (!spare) spare = &x; }
+            else if (x.inflight.empty()) { if (!idle) idle = &x; }
+            else if (x.inflight.size() < pipeline_depth && (!shared || x.inflight.size() < shared->inflight.size())) shared = &x;
+        }
+        if (!idle && spare && connecting < p.waiting.size()) {
+            if (!up_open(r, *spare)) { up_fail(r, *spare, true); return; }
+            continue;
+        }
+        Upstream* u = idle ? idle : shared; if (!u) return;
+        Conn* c = p.waiting.top(); p.waiting.pop();
+        c->sent_at = Steady::now(); if (u->inflight.empty()) u->progress = c->sent_at;
+        u->inflight.push_back(c); u->out.append(c->req, 2); trace(TR_CHECKOUT, c->trace, u->idx);
+        if (!up_flush(r, *u)) return;
+        trace(TR_SENT, c->trace, u->idx);
+    }
+}
+
+// Reply bytes into the pipe (or hold buffer); only called with nothing held.
+static ssize_t up_fill(Upstream& u, size_t want) {
+    if (u.pipe[0] != -1) return splice(u.fd, nullptr, u.pipe[1], nullptr, std::min(want, PIPE_CHUNK), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    u.hold_off = 0; return recv(u.fd, u.hold.data(), std::min(want, u.hold.size()), 0);
+}
+// Held bytes out to the client, or aside until its turn (or for the cache), or dropped if it is gone.
+static ssize_t up_drain(Upstream& u, Conn* c) {
+    Client* cl = c->cl; bool keep = !cl->dead || c->cache == CACHE_FILL;
+    if (c->direct && !cl->dead) {
+        if (u.pipe[0] != -1) return splice(u.pipe[0], nullptr, cl->fd, nullptr, u.held, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        ssize_t w = send(cl->fd, u.hold.data() + u.hold_off, u.held, MSG_NOSIGNAL); if (w > 0) u.hold_off += w;
+        return w;
+    }
+    if (u.pipe[0] == -1) { if (keep) c->early.append(u.hold.data() + u.hold_off, u.held); u.hold_off += u.held; return ssize_t(u.held); }
+    char buf[16384]; ssize_t k = read(u.pipe[0], buf, std::min(u.held, sizeof(buf)));
+    if (k > 0 && keep) c->early.append(buf, size_t(k));
+    return k;
+}
+
+static void up_finish(Reactor& r, Upstream& u, Conn* c) {
+    u.inflight.pop_front(); u.rgot = 0; trace(TR_DONE, c->trace, u.idx);
+    vtime_t total = to_ticks(Steady::now() - c->parsed_at);
+    sched.observe(u.idx, c->req[0], c->req[1]-'0', u.took); health_pass(u.idx);     // c->backend was released at the first byte
+    if (!c->cl->dead) metrics.latency(u.idx, c->req[0], total - u.took, u.took, total);
+    alloc_check();
+    cache_settle(r, c, true);
+    c->complete = true; cl_advance(r, c->cl);
+}
+
+// Moves replies from u to the clients at the head of its in‑flight FIFO until
+// one side would block; false if the upstream failed.
+static bool up_relay(Reactor& r, Upstream& u) {
+    while (!u.inflight.empty()) {
+        Conn* c = u.inflight.front();
+        while (u.held) {
+            ssize_t w = up_drain(u, c);
+            if (w < 0 && errno == EAGAIN) { c->up = &u; c->cl->want_out = true; cl_watch(r, c->cl); up_arm(r, u); return true; }
+            if (w <= 0 && !c->cl->dead) { cl_kill(c->cl); continue; }
+            if (w <= 0) { up_fail(r, u, false); return false; }
+            u.held -= w; u.progress = Steady::now();
+        }
+        c->up = nullptr;
+        if (!c->direct && !c->early.empty() && c == c->cl->q.front()) cl_advance(r, c->cl);
+        if (u.rgot == reply_len) { up_finish(r, u, c); continue; }
+        ssize_t n = up_fill(u, reply_len - u.rgot);
+        if (n < 0 && errno == EAGAIN) break;
+        if (n <= 0) { up_fail(r, u, false); return false; }
+        Steady::time_point now = Steady::now(); u.progress = now;
+        if (!u.rgot) {
+            Steady::time_point t0 = c->sent_at > u.last_used ? c->sent_at : u.last_used;
+            u.took = to_ticks(now - t0); u.last_used = now; conn_release(c, u.took); trace(TR_FIRST_BYTE, c->trace, u.idx);
+            c->direct = c == c->cl->q.front() && c->cache != CACHE_FILL;
+        }
+        u.rgot += n; u.held = n;
+    }
+    up_arm(r, u);
+    return true;
+}
+
+static void on_upstream(Reactor& r, Upstream& u, uint32_t events) {
+    if (u.connecting) {
+        int err = 0; socklen_t len = sizeof(err); getsockopt(u.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) { up_fail(r, u, true); return; }
+        u.connecting = false; u.last_used = u.progress = Steady::now();
+        ev_ctl(r, EPOLL_CTL_MOD, u.fd, EPOLLIN, &u); up_pump(r, r.pools[u.idx]); return;
+    }
+    if ((events & EPOLLOUT) && !up_flush(r, u)) return;
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+    if (u.inflight.empty()) { up_fail(r, u, false); return; }      // idle upstream closed by the server
+    if (!up_relay(r, u)) return;
+    up_pump(r, r.pools[u.idx]);
+}
+
+// Schedules c (bound later under --policy=late); a shed request is complete at once.
+template <class P> static void cl_dispatch(Reactor& r, Conn* c) {
+    int base = c->req[1] - '0';
+    if (std::is_same<P, LatePolicy>::value) {   // bound by late_pump; only --max-inflight is checked here
+        if (!max_inflight || sched.total.load(std::memory_order_relaxed) + r.late.size() < max_inflight) { r.late.push(c, c->req[0], base, to_ticks(c->parsed_at - start_ts), sched); return; }
+        metrics.count(GC_SHED);
+    } else { c->backend = pick_backend<P>(c->req[0], base, c->est); if (c->backend != SIZE_MAX) trace(TR_PICKED, c->trace, c->backend); }
+    if (c->backend == SIZE_MAX) {           // shed: "ER" in its turn, or a reset once the replies before it are out
+        cache_settle(r, c, false); c->complete = true;
+        if (shed_reply) c->early.assign(SHED_REPLY, 2); else c->failed = c->reset_client = true;
+        return;
+    }
+    UpstreamPool& p = r.pools[c->backend];
+    p.waiting.push(c, queue_rank(c->req[0], c->est, c->parsed_at)); up_pump(r, p);
+}
+// True if c is answered from the cache, or waits on a fill of the same request on this reactor.
+static bool cache_lookup(Reactor& r, Conn* c) {
+    size_t k = ReplyCache::key(c->req[0], c->req[1] - '0');
+    if (cache.get(k, c->early)) { metrics.count(GC_CACHE_HITS); c->complete = true; trace(TR_DONE, c->trace); return true; }
+    if (Conn* fill = r.filling[k]) { metrics.count(GC_CACHE_COALESCED); c->cache = CACHE_FOLLOW; c->next_follower = fill->followers; fill->followers = c; return true; }
+    metrics.count(GC_CACHE_MISSES); c->cache = CACHE_FILL; r.filling[k] = c;
+    return false;
+}
+
+// Takes in requests until the socket would block, the window is full or the client is done sending.
+template <class P> static void cl_read(Reactor& r, Client* cl) {
+    while (cl->reading && cl->q.size() < client_window()) {
+        ssize_t n = recv(cl->fd, cl->req + cl->got, 2 - cl->got, 0);
+        if (n < 0 && errno == EAGAIN) break;
+        if (n < 0) { cl_kill(cl); break; }
+        if (n == 0) { cl->reading = false; break; }  // finish what was asked, then close
+        if ((cl->got += n) < 2) continue;
+        cl->got = 0;
+        int base = cl->req[1] - '0'; if (base <= 0 || base > 9) { metrics.count(GC_BAD_REQUESTS); cl->reading = false; break; }
+        Conn* c = conn_slab.get(); retired.reserve(conn_slab.free_list.capacity()); c->reset(cl, cl->req); c->parsed_at = Steady::now(); cl->q.push_back(c);
+        c->trace = trace_request(cl->trace);
+        cl->reading = keepalive > 0;
+        if (cache.wants(c->req[0]) && cache_lookup(r, c)) continue;
+        cl_dispatch<P>(r, c);
+    }
+    cl_advance(r, cl);
+}
+
+template <class P> static void on_client(Reactor& r, Client* cl, uint32_t events) {
+    if (cl->fd == -1) return;
+    if (events & (EPOLLERR | EPOLLHUP)) { cl_kill(cl); cl_advance(r, cl); return; }
+    if ((events & EPOLLOUT) && cl->want_out) {
+        cl->want_out = false; Conn* h = cl->q.front();
+        if (h->up) { Upstream& u = *h->up; if (up_relay(r, u)) up_pump(r, r.pools[u.idx]); }
+        else cl_advance(r, cl);
+    }
+    if (cl->fd != -1 && (events & EPOLLIN)) cl_read<P>(r, cl);
+    cl_watch(r, cl);
+}
+
+static void on_accept(Reactor& r, int listen_fd) {
+    while (true) {
+        int cfd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) { if (errno != EAGAIN && errno != EINTR) perror("accept"); return; }
+        tune_client(cfd); Client* cl = client_slab.get(); retired_clients.reserve(client_slab.free_list.capacity()); cl->reset(cfd); cl->trace = trace_start(TR_ACCEPT);
+        metrics.count(GC_ACCEPTS); ev_ctl(r, EPOLL_CTL_ADD, cfd, EPOLLIN, cl);
+    }
+}
+
+/* Late binding: while some live backend's pool could send a request now (an
+ * idle or unopened upstream, or room to pipeline, and nothing queued), the
+ * role whose best waiter ranks lowest takes it, on the backend of that role
+ * that drains first, charged as a pick would be.  Runs once per epoll batch
+ * so the requests and free connections of a whole batch are matched at once;
+ * the loop's timeout retries while every backend is down. */
+static bool pool_room(const UpstreamPool& p) {
+    if (!p.waiting.empty()) return false;
+    for (const Upstream& u : p.conns) if (!u.connecting && (u.fd == -1 || u.inflight.size() < pipeline_depth)) return true;
+    return false;
+}
+static void late_pump(Reactor& r) {
+    while (!r.late.empty()) {
+        bool room[MAX_ROLES] = {}; size_t free_of[MAX_ROLES] = {};
+        for (size_t i = 0; i < r.pools.size(); ++i) {
+            if (!sched.up(i) || !pool_room(r.pools[i])) continue;
+            Role ro = sched.s[i].role;
+            if (!room[ro] || sched.key(uint32_t(i)) < sched.key(uint32_t(free_of[ro]))) { room[ro] = true; free_of[ro] = i; }
+        }
+        Role ro = VIDEO; if (!r.late.best(room, ro)) return;
+        Conn* c = r.late.take(ro);
+        if (c->cl->dead) { conn_drop(r, c); continue; }
+        size_t i = free_of[ro]; int base = c->req[1] - '0';
+        sched.charge(i, c->req[0], base, now_ticks()); sched.begin(i); metrics.count(i, BC_REQUESTS); trace(TR_PICKED, c->trace, i);
+        c->backend = i; c->est = sched.cost(c->req[0], base, i);
+        UpstreamPool& p = r.pools[i]; p.waiting.push(c, queue_rank(c->req[0], c->est, c->parsed_at)); up_pump(r, p);
+    }
+}
+
+static void reap_idle_upstreams(Reactor& r) {
+    Steady::time_point now = Steady::now();
+    for (size_t i = 0; i < r.pools.size(); ++i) {
+        Steady::time_point cutoff = idle_cutoff(i, now);
+        for (Upstream& u : r.pools[i].conns) if (u.fd != -1 && !u.connecting && u.inflight.empty() && u.last_used < cutoff) up_close(u);
+    }
+}
+// After an upgrade the new process accepts; this reactor serves the clients it has.
+static void stop_accepting(Reactor& r) {
+    for (Listener& l : r.listeners) epoll_ctl(r.epfd, EPOLL_CTL_DEL, l.fd, nullptr);
+    r.listeners.clear(); acceptors_running.fetch_sub(1);
+}
+
+/* Deadlines, checked every EXPIRE_MS: a connect past --connect-timeout, or an
+ * upstream owing a reply that has been silent for --io-timeout, fails as if
+ * the server had dropped it; a client that has not taken held reply bytes for
+ * --io-timeout is treated as gone so the upstream can move on. */
+static const int EXPIRE_MS = 100;
+static void expire_upstreams(Reactor& r) {
+    Steady::time_point now = Steady::now();
+    for (UpstreamPool& p : r.pools) for (Upstream& u : p.conns) {
+        if (u.fd == -1 || (!u.connecting && u.inflight.empty())) continue;
+        double silent = std::chrono::duration<double>(now - u.progress).count(), limit = u.connecting ? connect_timeout_s : io_timeout_s;
+        if (limit <= 0 || silent < limit) continue;
+        if (u.connecting) { errno = ETIMEDOUT; up_fail(r, u, true); }
+        else if (u.held) { cl_kill(u.inflight.front()->cl); u.progress = now; if (up_relay(r, u)) up_pump(r, p); }
+        else { backend_timeout(u.idx); up_fail(r, u, false); }
+    }
+}
+
+template <class P> static void reactor_loop(std::vector<int> listen_fds) {
+    Reactor r; r.epfd = epoll_create1(EPOLL_CLOEXEC); if (r.epfd < 0) { perror("epoll_create1"); return; }
+    r.pools.resize(backends.size());
+    for (size_t i = 0; i < backends.size(); ++i) {
+        r.pools[i].conns.reserve(reactor_pool_max); while (r.pools[i].conns.size() < reactor_pool_max) r.pools[i].conns.emplace_back(i);
+        for (Upstream& u : r.pools[i].conns) u.inflight.reserve(pipeline_depth);
+        r.pools[i].waiting.reserve(SLAB_PREFILL);
+    }
+    r.late.init(sched.live_roles); r.late.reserve(SLAB_PREFILL);
+    if (cache.on()) r.filling.assign(ReplyCache::KEYS, nullptr);
+    r.dispatch = cl_dispatch<P>;
+    r.listeners.reserve(listen_fds.size());
+    for (int fd : listen_fds) { r.listeners.emplace_back(fd); ev_ctl(r, EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLEXCLUSIVE, &r.listeners.back()); }
+    conn_slab.prefill(SLAB_PREFILL); client_slab.prefill(SLAB_PREFILL);
+    retired.reserve(conn_slab.free_list.capacity()); retired_clients.reserve(client_slab.free_list.capacity());
+    epoll_event evs[256]; Steady::time_point next_reap = Steady::now() + std::chrono::seconds(1);
+    bool deadlines = connect_timeout_s > 0 || io_timeout_s > 0;
+    while (true) {
+        int n = epoll_wait(r.epfd, evs, 256, deadlines ? EXPIRE_MS : 1000);
+        if (n < 0) { if (errno == EINTR) continue; perror("epoll_wait"); return; }
+        for (int i = 0; i < n; ++i) {
+            EvSource* s = static_cast<EvSource*>(evs[i].data.ptr);
+            if (s->kind == EvSource::LISTEN) on_accept(r, static_cast<Listener*>(s)->fd);
+            else if (s->kind == EvSource::CLIENT) on_client<P>(r, static_cast<Client*>(s), evs[i].events);
+            else on_upstream(r, *static_cast<Upstream*>(s), evs[i].events);
+        }
+        if (deadlines) expire_upstreams(r);
+        if (std::is_same<P, LatePolicy>::value) late_pump(r);
+        for (Conn* c : retired) conn_slab.put(c);
+        for (Client* c : retired_clients) client_slab.put(c);
+        retired.clear(); retired_clients.clear();
+        if (Steady::now() >= next_reap) { reap_idle_upstreams(r); next_reap = Steady::now() + std::chrono::seconds(1); }
+        if (!r.listeners.empty() && upgrading.load(std::memory_order_relaxed)) stop_accepting(r);
+    }
+}
+
+/* ───────────── io_uring engine ─────────────
+ * Same per‑reactor pools as epoll, but every socket operation is an SQE and
+ * each loop iteration is a single io_uring_enter that submits all of them and
+ * waits for the next completions.  Per request: one multishot accept CQE
+ * (a single‑shot accept re‑armed per connection on kernels before 5.19, which
+ * refuse the multishot one with EINVAL), a read of the request, a linked send → recv on the upstream (connect linked
+ * in front when the pool grows) and a linked write → close to the client.
+ * Request and reply live in one registered arena, so reads and writes are the
+ * _FIXED variants; if the kernel will not pin it they fall back to recv/send.
+ * Deadlines are linked timeouts behind the connect, each upstream recv and
+ * the client's request read.  One request per client and per upstream
+ * connection at a time (no --keepalive or --pipeline here).  A reply cache
+ * hit is sent from the client's own copy (a plain SEND, it is not in the
+ * arena); a fill keeps the chunks it relays, and clients of this reactor
+ * waiting on the same request are sent the whole reply when it is in.
+ */
+#if LB_HAVE_URING
+// U_RECV_TMO carries the backend index instead of a client slot; U_LINK_TMO and U_CANCEL are ignored.
+enum UOp : uint8_t { U_ACCEPT, U_REQ, U_CONNECT, U_UP_SEND, U_UP_RECV, U_CL_SEND, U_CL_CLOSE, U_TIMEOUT, U_LINK_TMO, U_RECV_TMO, U_CANCEL, U_CACHE_SEND };
+
+struct UClient {
+    int fd = -1; char* buf = nullptr;           // arena slot: 2‑byte request, then a reply chunk
+    size_t got = 0, backend = SIZE_MAX, up = SIZE_MAX, left = 0, chunk = 0, off = 0;
+    bool active = false, first = true, dead = false, retried = false, moved = false;   // active: counted in sched
+    Steady::time_point parsed_at, sent_at; vtime_t took = 0, est = 0;   // est: ticket on backend
+    uint32_t trace = 0;
+    CacheClaim cache = CACHE_NONE; std::string reply;   // HIT: the reply to send; FILL: the reply so far
+    uint32_t followers = UINT32_MAX, next = UINT32_MAX;  // FILL: first waiting slot; FOLLOW: the next one
+};
+struct UUpstream { int fd = -1; bool busy = false; Steady::time_point last_used; };
+
+struct URing {
+    Uring ring; bool fixed = false;
+    std::vector<UClient> clients; std::vector<uint32_t> free_slots;
+    std::unique_ptr<char[]> arena; size_t chunk_max = 0;
+    std::vector<std::vector<UUpstream>> ups; std::vector<WaitQueue<uint32_t>> waiting;
+    std::vector<int> listeners; bool accepting = true;
+    std::vector<bool> single_accept;            // per listener: the kernel refused a multishot accept on it
+    __kernel_timespec tick{1, 0}, connect_ts{}, io_ts{};
+    std::vector<uint32_t> filling;              // per cache key, the FILL slot in flight (UINT32_MAX: none)
+    void (*dispatch)(URing&, uint32_t) = nullptr;   // u_pick of the running policy
+};
+
+static const uint32_t URING_CLIENTS = 1024;    // per reactor; accepts beyond this are closed
+
+static uint64_t u_tag(uint32_t slot, UOp op) { return uint64_t(slot) << 8 | op; }
+
+static io_uring_sqe* u_read(URing& u, int fd, char* buf, size_t n, uint64_t tag) {
+    io_uring_sqe* e = u.ring.prep(u.fixed ? IORING_OP_READ_FIXED : IORING_OP_RECV, fd, buf, unsigned(n), 0, tag); return e;
+}
+static io_uring_sqe* u_write(URing& u, int fd, const char* buf, size_t n, uint64_t tag) {
+    io_uring_sqe* e = u.ring.prep(u.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_SEND, fd, buf, unsigned(n), 0, tag);
+    if (!u.fixed) e->msg_flags = MSG_NOSIGNAL;
+    return e;
+}
+
+// Links a deadline behind e (which must be the last SQE queued); null if none is configured.
+static io_uring_sqe* u_deadline(URing& u, io_uring_sqe* e, const __kernel_timespec& ts, uint64_t tag) {
+    if (!ts.tv_sec && !ts.tv_nsec) return nullptr;
+    e->flags |= IOSQE_IO_LINK; return u.ring.prep(IORING_OP_LINK_TIMEOUT, -1, &ts, 1, 0, tag);
+}
+// The next reply chunk from the client's upstream, under --io-timeout.
+static void u_recv_up(URing& u, uint32_t slot) {
+    UClient& c = u.clients[slot]; u.ring.room(2);
+    u_deadline(u, u_read(u, u.ups[c.backend][c.up].fd, c.buf + 2, std::min(c.left, u.chunk_max), u_tag(slot, U_UP_RECV)), u.io_ts, u_tag(uint32_t(c.backend), U_RECV_TMO));
+}
+
+static void u_arm_accept(URing& u, uint32_t i) {
+    io_uring_sqe* e = u.ring.prep(IORING_OP_ACCEPT, u.listeners[i], nullptr, 0, 0, u_tag(i, U_ACCEPT));
+    if (!u.single_accept[i]) e->ioprio = IORING_ACCEPT_MULTISHOT;
+    e->accept_flags = SOCK_CLOEXEC;
+}
+static void u_arm_timeout(URing& u) { u.ring.prep(IORING_OP_TIMEOUT, -1, &u.tick, 1, 0, u_tag(0, U_TIMEOUT)); }
+
+static void u_cache_settle(URing& u, uint32_t slot, bool ok);
+static void u_free(URing& u, uint32_t slot) {
+    UClient& c = u.clients[slot];
+    u_cache_settle(u, slot, false); c.cache = CACHE_NONE;
+    if (c.active) { if (c.first) sched.cancel(c.backend, c.est, now_ticks()); sched.done(c.backend); c.active = false; }   // never answered
+    c.fd = -1; u.free_slots.push_back(slot); metrics.count(GC_CLOSES);
+}
+
+static void u_start(URing& u, uint32_t slot, size_t ui);
+
+// Hands a released (or dead) upstream to the next queued client.
+static void u_up_next(URing& u, size_t b, size_t ui) {
+    if (u.waiting[b].empty()) return;
+    uint32_t slot = u.waiting[b].top(); u.waiting[b].pop(); u_start(u, slot, ui);
+}
+
+// connect (if needed) → send request → recv first chunk, as one linked chain.
+static void u_start(URing& u, uint32_t slot, size_t ui) {
+    UClient& c = u.clients[slot]; UUpstream& up = u.ups[c.backend][ui];
+    c.up = ui; c.left = reply_len; c.first = true; c.sent_at = Steady::now(); up.busy = true; trace(TR_CHECKOUT, c.trace, c.backend);
+    u.ring.room(5);
+    if (up.fd == -1) {
+        up.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (up.fd < 0) { perror("socket"); up.busy = false; metrics.count(c.backend, BC_FAILURES); close(c.fd); u_free(u, slot); return; }
+        tune_upstream(up.fd); ++backends[c.backend].open;
+        metrics.count(c.backend, BC_CONNECTS);
+        io_uring_sqe* e = u.ring.prep(IORING_OP_CONNECT, up.fd, &backends[c.backend].addr, 0, sizeof(sockaddr_in), u_tag(slot, U_CONNECT));
+        e->flags = IOSQE_IO_LINK;
+        if (io_uring_sqe* t = u_deadline(u, e, u.connect_ts, u_tag(slot, U_LINK_TMO))) t->flags = IOSQE_IO_LINK;   // the chain goes on past it
+    }
+    u_write(u, up.fd, c.buf, 2, u_tag(slot, U_UP_SEND))->flags = IOSQE_IO_LINK;
+    u_recv_up(u, slot);
+}
+
+static void u_dispatch(URing& u, uint32_t slot) {
+    std::vector<UUpstream>& pool = u.ups[u.clients[slot].backend];
+    size_t idle = SIZE_MAX, spare = SIZE_MAX;
+    for (size_t i = 0; i < pool.size(); ++i) {
+        if (pool[i].busy) continue;
+        if (pool[i].fd == -1) { if (spare == SIZE_MAX) spare = i; }
+        else if (idle == SIZE_MAX || pool[i].last_used > pool[idle].last_used) idle = i;
+    }
+    if (idle != SIZE_MAX) u_start(u, slot, idle);
+    else if (spare != SIZE_MAX) u_start(u, slot, spare);
+    else { UClient& c = u.clients[slot]; u.waiting[c.backend].push(slot, queue_rank(c.buf[0], c.est, c.parsed_at)); }
+}
+
+// Moves everything queued on an ejected backend elsewhere.
+static void u_evacuate(URing& u, size_t b) {
+    WaitQueue<uint32_t> q; q.swap(u.waiting[b]);
+    for (; !q.empty(); q.pop()) { uint32_t slot = q.top();
+        UClient& c = u.clients[slot];
+        if (c.moved || !redispatch) { metrics.count(b, BC_FAILURES); close(c.fd); u_free(u, slot); continue; }
+        c.moved = true; c.backend = redispatch(c.buf[0], c.buf[1]-'0', b, c.est); u_dispatch(u, slot);
+    }
+}
+
+static void u_up_release(URing& u, UClient& c) {
+    UUpstream& up = u.ups[c.backend][c.up];
+    up.busy = false; up.last_used = Steady::now(); sched.done(c.backend); c.active = false;
+    u_up_next(u, c.backend, c.up);
+}
+
+// The next chunk (or the last, with its close linked behind) to the client.
+static void u_send_client(URing& u, uint32_t slot) {
+    UClient& c = u.clients[slot];
+    if (c.left) { u_write(u, c.fd, c.buf + 2 + c.off, c.chunk - c.off, u_tag(slot, U_CL_SEND)); return; }
+    u.ring.room(2);
+    u_write(u, c.fd, c.buf + 2 + c.off, c.chunk - c.off, u_tag(slot, U_CL_SEND))->flags = IOSQE_IO_LINK;
+    u.ring.prep(IORING_OP_CLOSE, c.fd, nullptr, 0, 0, u_tag(slot, U_CL_CLOSE));
+}
+
+// A cached reply to the client, with its close linked behind.
+static void u_send_reply(URing& u, uint32_t slot) {
+    UClient& c = u.clients[slot]; u.ring.room(2);
+    io_uring_sqe* e = u.ring.prep(IORING_OP_SEND, c.fd, c.reply.data() + c.off, unsigned(c.reply.size() - c.off), 0, u_tag(slot, U_CACHE_SEND));
+    e->msg_flags = MSG_NOSIGNAL; e->flags = IOSQE_IO_LINK;
+    u.ring.prep(IORING_OP_CLOSE, c.fd, nullptr, 0, 0, u_tag(slot, U_CL_CLOSE));
+}
+// A FILL is over: the slots waiting on it are sent its reply, or on failure picked a backend of their own.
+static void u_cache_settle(URing& u, uint32_t slot, bool ok) {
+    UClient& c = u.clients[slot];
+    if (c.cache != CACHE_FILL) return;
+    size_t k = ReplyCache::key(c.buf[0], c.buf[1] - '0');
+    c.cache = CACHE_NONE; u.filling[k] = UINT32_MAX;
+    if (ok) cache.put(k, c.reply.data(), c.reply.size());
+    for (uint32_t f = std::exchange(c.followers, UINT32_MAX), next; f != UINT32_MAX; f = next) {
+        UClient& x = u.clients[f]; next = std::exchange(x.next, UINT32_MAX); x.cache = CACHE_NONE;
+        if (ok) { x.cache = CACHE_HIT; x.reply = c.reply; x.off = 0; u_send_reply(u, f); }
+        else u.dispatch(u, f);
+    }
+}
+// True if the request in slot is answered from the cache, or waits on a fill of it on this reactor.
+static bool u_cache_lookup(URing& u, uint32_t slot) {
+    UClient& c = u.clients[slot]; size_t k = ReplyCache::key(c.buf[0], c.buf[1] - '0');
+    if (cache.get(k, c.reply)) { metrics.count(GC_CACHE_HITS); c.cache = CACHE_HIT; c.off = 0; u_send_reply(u, slot); return true; }
+    if (u.filling[k] != UINT32_MAX) { metrics.count(GC_CACHE_COALESCED); UClient& fill = u.clients[u.filling[k]]; c.cache = CACHE_FOLLOW; c.next = fill.followers; fill.followers = slot; return true; }
+    metrics.count(GC_CACHE_MISSES); c.cache = CACHE_FILL; c.reply.clear(); u.filling[k] = slot;
+    return false;
+}
+template <class P> static void u_pick(URing& u, uint32_t slot) {
+    UClient& c = u.clients[slot];
+    c.backend = pick_backend<P>(c.buf[0], c.buf[1] - '0', c.est);
+    if (c.backend == SIZE_MAX) { shed(c.fd); close(c.fd); u_free(u, slot); return; }
+    trace(TR_PICKED, c.trace, c.backend);
+    c.active = true;
+    u_dispatch(u, slot);
+}
+
+template <class P> static void u_complete(URing& u, const io_uring_cqe& e) {
+    uint32_t slot = uint32_t(e.user_data >> 8); int res = e.res;
+    switch (UOp(e.user_data & 0xff)) {
+    case U_TIMEOUT: {
+        u_arm_timeout(u);
+        Steady::time_point now = Steady::now();
+        for (size_t b = 0; b < u.ups.size(); ++b) {
+            Steady::time_point cutoff = idle_cutoff(b, now);
+            for (UUpstream& up : u.ups[b]) if (up.fd != -1 && !up.busy && up.last_used < cutoff) { close(up.fd); up.fd = -1; --backends[b].open; }
+        }
+        if (u.accepting && upgrading.load(std::memory_order_relaxed)) {     // the new process accepts from here on
+            u.accepting = false; acceptors_running.fetch_sub(1);
+            for (uint32_t i = 0; i < u.listeners.size(); ++i) u.ring.prep(IORING_OP_ASYNC_CANCEL, -1, nullptr, 0, 0, u_tag(i, U_CANCEL))->addr = u_tag(i, U_ACCEPT);
+        }
+        return;
+    }
+    case U_ACCEPT: {
+        bool refused = res == -EINVAL && !u.single_accept[slot];     // pre‑5.19 kernel: no multishot accept
+        if (refused) { u.single_accept[slot] = true; if (slot == 0) std::cerr << "[LB] no multishot accept in this kernel, accepting one at a time\n"; }
+        if (!(e.flags & IORING_CQE_F_MORE) && u.accepting) u_arm_accept(u, slot);
+        if (res < 0) { if (!refused && res != -EINTR && res != -EAGAIN && res != -ECANCELED) std::cerr << "[LB] accept: " << strerror(-res) << "\n"; return; }
+        metrics.count(GC_ACCEPTS);
+        if (u.free_slots.empty()) { close(res); metrics.count(GC_CLOSES); return; }
+        uint32_t s = u.free_slots.back(); u.free_slots.pop_back();
+        tune_client(res); UClient& c = u.clients[s]; c.fd = res; c.got = 0; c.trace = trace_start(TR_ACCEPT); c.dead = c.retried = c.moved = false; c.off = 0; c.cache = CACHE_NONE;
+        u.ring.room(2); u_deadline(u, u_read(u, c.fd, c.buf, 2, u_tag(s, U_REQ)), u.io_ts, u_tag(s, U_LINK_TMO));
+        return;
+    }
+    case U_REQ: {
+        UClient& c = u.clients[slot];
+        if (res <= 0) { close(c.fd); u_free(u, slot); return; }
+        if ((c.got += res) < 2) { u.ring.room(2); u_deadline(u, u_read(u, c.fd, c.buf + c.got, 2 - c.got, u_tag(slot, U_REQ)), u.io_ts, u_tag(slot, U_LINK_TMO)); return; }
+        int base = c.buf[1] - '0'; if (base <= 0 || base > 9) { metrics.count(GC_BAD_REQUESTS); close(c.fd); u_free(u, slot); return; }
+        c.parsed_at = Steady::now(); c.first = true; c.trace = trace_request(c.trace);
+        if (cache.wants(c.buf[0]) && u_cache_lookup(u, slot)) return;
+        u_pick<P>(u, slot);
+        return;
+    }
+    // A failed connect or send cancels the rest of the chain, so the recv reports it.
+    // (IOSQE_CQE_SKIP_SUCCESS would save these CQEs but also hides the cancelled recv.)
+    case U_CONNECT: {
+        size_t i = u.clients[slot].backend;
+        if (res < 0) { std::cerr << "[LB] cannot connect to " << backends[i].ip << ":" << backends[i].port << "\n"; health_fail(i); }
+        else trace(TR_CONNECTED, u.clients[slot].trace, i);
+        return;
+    }
+    case U_UP_SEND: if (res >= 0) trace(TR_SENT, u.clients[slot].trace, u.clients[slot].backend); return;
+    case U_LINK_TMO: case U_CANCEL: return;
+    case U_RECV_TMO: if (res == -ETIME) backend_timeout(slot); return;
+    case U_UP_RECV: {
+        UClient& c = u.clients[slot];
+        if (res <= 0) {
+            // a pooled connection the server closed while idle gets one fresh retry, then
+            // a request nothing was relayed for yet moves once to another backend
+            bool fresh = c.first && c.left == reply_len, stale = res == 0 && fresh && !c.retried;
+            UUpstream& up = u.ups[c.backend][c.up]; close(up.fd); up.fd = -1; --backends[c.backend].open;
+            if (stale) { c.retried = true; u_start(u, slot, c.up); return; }
+            size_t from = c.backend; up.busy = false;
+            if (fresh && !c.moved && redispatch) { c.moved = true; c.backend = redispatch(c.buf[0], c.buf[1]-'0', from, c.est); u_dispatch(u, slot); }
+            else { metrics.count(from, BC_FAILURES); close(c.fd); u_free(u, slot); }
+            if (!sched.up(from)) u_evacuate(u, from); else u_up_next(u, from, c.up);
+            return;
+        }
+        if (c.first) { c.first = false; c.took = to_ticks(Steady::now() - c.sent_at); trace(TR_FIRST_BYTE, c.trace, c.backend); sched.observe(c.backend, c.buf[0], c.buf[1]-'0', c.took);
+            sched.settle(c.backend, c.est, c.took, now_ticks()); health_pass(c.backend); }
+        c.left -= res; c.chunk = res; c.off = 0;
+        if (c.cache == CACHE_FILL) { c.reply.append(c.buf + 2, size_t(res)); if (!c.left) u_cache_settle(u, slot, true); }
+        if (!c.left) { u_up_release(u, c); alloc_check(); }
+        if (!c.dead) { u_send_client(u, slot); return; }
+        if (c.left) { u_recv_up(u, slot); return; }
+        close(c.fd); u_free(u, slot);
+        return;
+    }
+    case U_CL_SEND: {
+        UClient& c = u.clients[slot];
+        if (res == -ECANCELED) return;
+        if (res > 0 && size_t(res) < c.chunk - c.off) { c.off += res; u_send_client(u, slot); return; }   // short write broke the link to close
+        if (res <= 0) {
+            c.dead = true;
+            if (!c.left) { close(c.fd); u_free(u, slot); return; }                 // its linked close was cancelled
+        }
+        if (c.left) u_recv_up(u, slot);
+        return;
+    }
+    case U_CACHE_SEND: {
+        UClient& c = u.clients[slot];
+        if (res == -ECANCELED) return;
+        if (res > 0 && size_t(res) < c.reply.size() - c.off) { c.off += res; u_send_reply(u, slot); return; }   // short write broke the link to close
+        if (res <= 0) { close(c.fd); u_free(u, slot); }     // its linked close was cancelled
+        return;
+    }
+    case U_CL_CLOSE: {
+        if (res == -ECANCELED) return;
+        UClient& c = u.clients[slot];
+        if (c.cache == CACHE_HIT) { trace(TR_DONE, c.trace); u_free(u, slot); return; }
+        vtime_t total = to_ticks(Steady::now() - c.parsed_at); trace(TR_DONE, c.trace, c.backend);
+        if (!c.dead) metrics.latency(c.backend, c.buf[0], total - c.took, c.took, total);
+        u_free(u, slot);
+        return;
+    }
+    }
+}
+
+// false if io_uring cannot be set up here, so the caller can run epoll instead
+template <class P> static bool uring_loop(const std::vector<int>& listen_fds) {
+    URing u;
+    if (!u.ring.init(4096)) { std::cerr << "[LB] io_uring unavailable (" << strerror(errno) << "), using epoll\n"; return false; }
+    u.chunk_max = std::min(reply_len, size_t(16384));
+    size_t stride = (2 + u.chunk_max + 63) & ~size_t(63);
+    u.arena.reset(new char[stride * URING_CLIENTS]);
+    iovec iov{ u.arena.get(), stride * URING_CLIENTS };
+    u.fixed = u.ring.register_buffers(&iov, 1) == 0;
+    if (!u.fixed) std::cerr << "[LB] cannot register io_uring buffers (" << strerror(errno) << "), using recv/send\n";
+    u.clients.resize(URING_CLIENTS);
+    for (uint32_t i = URING_CLIENTS; i-- > 0;) { u.clients[i].buf = u.arena.get() + i * stride; u.free_slots.push_back(i); }
+    u.ups.assign(backends.size(), std::vector<UUpstream>(reactor_pool_max)); u.waiting.resize(backends.size());
+    for (WaitQueue<uint32_t>& q : u.waiting) q.reserve(URING_CLIENTS);
+    u.listeners = listen_fds; u.single_accept.assign(listen_fds.size(), false);
+    auto ts = [](double sec) { __kernel_timespec t{}; if (sec > 0) { t.tv_sec = time_t(sec); t.tv_nsec = long((sec - double(t.tv_sec)) * 1e9); } return t; };
+    u.connect_ts = ts(connect_timeout_s); u.io_ts = ts(io_timeout_s);
+    if (cache.on()) u.filling.assign(ReplyCache::KEYS, UINT32_MAX);
+    u.dispatch = u_pick<P>;
+    for (uint32_t i = 0; i < u.listeners.size(); ++i) u_arm_accept(u, i);
+    u_arm_timeout(u);
+    while (true) {
+        if (u.ring.enter(1) < 0) { perror("io_uring_enter"); return true; }
+        u.ring.reap([&](const io_uring_cqe& e) { u_complete<P>(u, e); });
+    }
+}
+#else
+template <class P> static bool uring_loop(const std::vector<int>&) { std::cerr << "[LB] built without io_uring, using epoll\n"; return false; }
+#endif
+
+/* ───────────── coroutine engine ─────────────
+ * Epoll reactors as in the epoll engine, but each client is one coroutine
+ * that reads like the request flow: read the request, pick, check out an
+ * upstream, send, relay the reply, with co_await wherever a socket would
+ * block.  Sockets are registered once, edge‑triggered for both directions; an
+ * op that gets EAGAIN parks its coroutine on the socket and the next edge
+ * resumes it.  Events carry a slot id plus generation, so one for a socket
+ * closed earlier in the same batch is ignored.  Deadlines are swept every
+ * EXPIRE_MS and resume an expired waiter with CO_TIMEDOUT.  Pools are per
+ * reactor with one request per upstream connection at a time (no --pipeline
+ * here); with --keepalive a client's requests are served one after another.
+ * A reply cache miss whose request is already being fetched on this reactor
+ * parks on that fetch (CoFollow) instead of sending its own.
+ */
+#if LB_HAVE_CORO
+struct CoReactor;
+static const ssize_t CO_TIMEDOUT = -2;
+
+struct CoSock {
+    CoReactor* r = nullptr; int fd = -1; uint32_t id = 0;
+    std::coroutine_handle<> reader, writer;     // parked on EPOLLIN / EPOLLOUT
+    Steady::time_point deadline;
+    bool expired = false, idle = false;         // idle: pooled upstream, closed if the server hangs up
+    std::atomic<int>* counted = nullptr;        // an upstream's Backend::open, dropped on close
+    CoSock() {}
+    CoSock(const CoSock&) = delete;
+    CoSock& operator=(const CoSock&) = delete;
+    ~CoSock() { close(); }
+    void open(CoReactor& r, int fd);
+    void close();
+};
+
+struct CoUp {
+    CoSock sock; bool busy = false;
+    int pipe[2] = { -1, -1 }; std::vector<char> hold;  // reply bytes in flight, or the same without splice()
+    Steady::time_point last_used;
+};
+struct CoPoolWait;
+struct CoFill;
+struct CoPool { std::vector<std::unique_ptr<CoUp>> conns; WaitQueue<CoPoolWait*> waiting; };   // waiting: best queue rank first
+
+struct CoReactor {
+    int epfd = -1;
+    struct Slot { CoSock* s = nullptr; uint32_t gen = 0; };
+    std::vector<Slot> slots; std::vector<uint32_t> free_slots;
+    std::vector<CoPool> pools;
+    Ring<std::coroutine_handle<>> ready;        // pool waiters and expired waits to resume after this batch
+    std::vector<CoFill*> filling;               // per cache key, the fetch in flight; empty without --cache-ttl
+};
+static const uint64_t CO_LISTENER = uint64_t(UINT32_MAX) << 32;     // event data: listener fd in the low half
+
+void CoSock::open(CoReactor& rr, int sfd) {
+    r = &rr; fd = sfd;
+    if (r->free_slots.empty()) { r->slots.emplace_back(); r->free_slots.reserve(r->slots.capacity()); r->free_slots.push_back(uint32_t(r->slots.size() - 1)); }
+    id = r->free_slots.back(); r->free_slots.pop_back(); r->slots[id].s = this;
+    epoll_event ev{}; ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET; ev.data.u64 = uint64_t(r->slots[id].gen) << 32 | id;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) perror("epoll_ctl");
+}
+void CoSock::close() {
+    if (fd == -1) return;
+    ::close(fd); fd = -1; idle = false;
+    if (counted) { --*counted; counted = nullptr; }
+    CoReactor::Slot& sl = r->slots[id]; sl.s = nullptr; sl.gen = (sl.gen + 1) & 0x7fffffff; r->free_slots.push_back(id);
+}
+
+// Parks the coroutine until s is readable (or writable); false if timeout_s passed first.
+struct CoWait {
+    CoSock& s; bool write; double timeout_s;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        (write ? s.writer : s.reader) = h; s.expired = false;
+        s.deadline = timeout_s > 0 ? Steady::now() + std::chrono::duration_cast<Steady::duration>(std::chrono::duration<double>(timeout_s)) : Steady::time_point::max();
+    }
+    bool await_resume() const noexcept { return !s.expired; }
+};
+// Queued on a full pool until co_checkin hands over `got` (nullptr: the backend is down).
+struct CoPoolWait {
+    CoPool& p; vtime_t rank; CoUp* got = nullptr; std::coroutine_handle<> h;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> c) { h = c; p.waiting.push(this, rank); }
+    void await_resume() const noexcept {}
+};
+
+// Parked on another coroutine's cache fill until it settles; true with its reply in `reply`.
+struct CoFollow {
+    CoFill& f; std::string& reply; bool ok = false; CoFollow* next = nullptr; std::coroutine_handle<> h{};
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> c);
+    bool await_resume() const noexcept { return ok; }
+};
+struct CoFill { CoFollow* followers = nullptr; };
+void CoFollow::await_suspend(std::coroutine_handle<> c) { h = c; next = f.followers; f.followers = this; }
+// The fill for key k is over: its followers resume after this batch, with `reply` unless it failed.
+static void co_cache_settle(CoReactor& r, size_t k, CoFill& f, const std::string* reply) {
+    r.filling[k] = nullptr;
+    if (reply) cache.put(k, reply->data(), reply->size());
+    for (CoFollow* w = f.followers; w; w = w->next) { if (reply) { w->reply = *reply; w->ok = true; } r.ready.push_back(w->h); }
+}
+
+// n bytes read (fewer only at EOF), -1 on error, CO_TIMEDOUT after timeout_s of silence.
+static Co<ssize_t> co_read(CoSock& s, char* p, size_t n, double timeout_s) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t k = recv(s.fd, p + got, n - got, 0);
+        if (k > 0) { got += k; continue; }
+        if (k == 0) break;
+        if (errno != EAGAIN) co_return -1;
+        if (!co_await CoWait{ s, false, timeout_s }) co_return CO_TIMEDOUT;
+    }
+    co_return ssize_t(got);
+}
+static Co<ssize_t> co_write(CoSock& s, const char* p, size_t n, double timeout_s) {
+    size_t put = 0;
+    while (put < n) {
+        ssize_t w = send(s.fd, p + put, n - put, MSG_NOSIGNAL);
+        if (w > 0) { put += w; continue; }
+        if (w < 0 && errno != EAGAIN) co_return -1;
+        if (!co_await CoWait{ s, true, timeout_s }) co_return CO_TIMEDOUT;
+    }
+    co_return ssize_t(put);
+}
+
+static Co<bool> co_connect(CoReactor& r, CoUp& u, size_t b) {
+    const Backend& be = backends[b];
+    int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s >= 0) tune_upstream(s);
+    bool ok = s >= 0 && (connect(s, (const sockaddr*)&be.addr, sizeof(be.addr)) == 0 || errno == EINPROGRESS);
+    if (s >= 0) { u.sock.open(r, s); u.sock.counted = &backends[b].open; ++*u.sock.counted; }
+    if (ok && errno == EINPROGRESS) {
+        int err = 0; socklen_t len = sizeof(err);
+        ok = co_await CoWait{ u.sock, true, connect_timeout_s } && getsockopt(u.sock.fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && !err;
+    }
+    if (!ok) { u.sock.close(); std::cerr << "[LB] cannot connect to " << be.ip << ":" << be.port << "\n"; health_fail(b); co_return false; }
+    if (u.pipe[0] == -1 && u.hold.empty() && pipe2(u.pipe, O_NONBLOCK | O_CLOEXEC) < 0) { u.pipe[0] = u.pipe[1] = -1; u.hold.resize(16384); }
+    metrics.count(b, BC_CONNECTS);
+    co_return true;
+}
+
+static void co_checkin(CoReactor& r, size_t b, CoUp& u, bool broken) {
+    CoPool& p = r.pools[b];
+    u.last_used = Steady::now();
+    if (broken) u.sock.close();
+    if (!p.waiting.empty()) { CoPoolWait* w = p.waiting.top(); p.waiting.pop(); w->got = &u; r.ready.push_back(w->h); return; }   // stays busy
+    u.busy = false; if (!broken) u.sock.idle = true;
+}
+
+// An idle upstream to b, else a new one up to the per‑reactor cap, else the
+// one checked in next when this request is the best‑ranked waiter (new
+// checkouts queue behind waiters); nullptr if connecting fails or b is down.
+static Co<CoUp*> co_checkout(CoReactor& r, size_t b, vtime_t rank, uint32_t trace_id) {
+    CoPool& p = r.pools[b];
+    CoUp* u = nullptr;
+    if (p.waiting.empty()) for (auto& x : p.conns) {
+        if (x->busy) continue;
+        if (x->sock.fd != -1) { x->busy = true; x->sock.idle = false; co_return x.get(); }
+        if (!u) u = x.get();
+    }
+    if (!u) {
+        if (!sched.up(b)) co_return nullptr;
+        CoPoolWait w{ p, rank, nullptr, {} };
+        co_await w;
+        if ((u = w.got) && !sched.up(b)) { co_checkin(r, b, *u, false); co_return nullptr; }   // ejected meanwhile: pass it on
+        if (!u || u->sock.fd != -1) co_return u;
+    }
+    u->busy = true;
+    if (co_await co_connect(r, *u, b)) { trace(TR_CONNECTED, trace_id, b); co_return u; }
+    u->busy = false;
+    for (; !p.waiting.empty(); p.waiting.pop()) r.ready.push_back(p.waiting.top()->h);   // got stays nullptr: the backend is down
+    co_return nullptr;
+}
+
+/* n reply bytes from u to the client through u's pipe, as relay_n does for
+ * the threads engine; if the client goes away or stalls past --io-timeout
+ * the rest is still read off u to keep it framed.  timed: u itself went
+ * quiet past --io-timeout.  With `copy` the reply is read into it for the
+ * reply cache and sent from there instead of through the pipe. */
+static Co<int> co_relay(CoUp& u, CoSock& cl, size_t n, Steady::time_point& first, bool& timed, uint32_t trace_id, size_t b, std::string* copy) {
+    static thread_local char sink[16384];
+    bool client_ok = cl.fd != -1, piped = u.pipe[0] != -1 && !copy; size_t left = n;
+    while (left) {
+        ssize_t k;
+        if (copy) { size_t at = copy->size(); copy->resize(at + std::min(left, PIPE_CHUNK)); k = recv(u.sock.fd, &(*copy)[at], copy->size() - at, 0); copy->resize(at + size_t(std::max<ssize_t>(k, 0))); }
+        else k = piped ? splice(u.sock.fd, nullptr, u.pipe[1], nullptr, std::min(left, PIPE_CHUNK), SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+                       : recv(u.sock.fd, u.hold.data(), std::min(left, u.hold.size()), 0);
+        if (k < 0 && errno == EAGAIN) {
+            if (co_await CoWait{ u.sock, false, io_timeout_s }) continue;
+            timed = true; k = -1;
+        }
+        if (k <= 0) co_return left == n ? RELAY_RETRY : RELAY_UPSTREAM;
+        if (left == n) { first = Steady::now(); trace(TR_FIRST_BYTE, trace_id, b); }
+        left -= k;
+        const char* src = copy ? copy->data() + copy->size() - k : u.hold.data();
+        for (size_t out = size_t(k), off = 0; out > 0;) {
+            ssize_t w = -1;
+            if (client_ok) w = piped ? splice(u.pipe[0], nullptr, cl.fd, nullptr, out, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+                                     : send(cl.fd, src + off, out, MSG_NOSIGNAL);
+            if (w > 0) { out -= w; off += w; continue; }
+            if (client_ok && w < 0 && errno == EAGAIN && co_await CoWait{ cl, true, io_timeout_s }) continue;
+            client_ok = false;
+            if (!piped) break;
+            while (out > 0) { ssize_t d = read(u.pipe[0], sink, std::min(out, sizeof(sink))); if (d <= 0) co_return RELAY_UPSTREAM; out -= d; }
+        }
+    }
+    co_return client_ok ? RELAY_OK : RELAY_CLIENT;
+}
+
+template <class P> static Spawn co_client(CoReactor& r, int fd) {
+    CoSock cl; cl.open(r, fd); uint32_t conn_trace = trace_start(TR_ACCEPT);
+    std::string reply;          // a cache hit's, or this request's as it fills the cache
+    do {
+        char req[2]; if (co_await co_read(cl, req, 2, io_timeout_s) != 2) break;
+        int base = req[1]-'0'; if (base <= 0 || base > 9) { metrics.count(GC_BAD_REQUESTS); break; }
+        Steady::time_point t0 = Steady::now(); uint32_t id = trace_request(conn_trace);
+        CoFill fill; size_t key = ReplyCache::key(req[0], base); bool filling = false;
+        if (cache.wants(req[0])) {
+            bool hit = cache.get(key, reply);
+            if (hit) metrics.count(GC_CACHE_HITS);
+            else if (CoFill* f = r.filling[key]) { metrics.count(GC_CACHE_COALESCED); hit = co_await CoFollow{ *f, reply, false, nullptr, {} }; }   // if it fails: a request of its own
+            else { metrics.count(GC_CACHE_MISSES); r.filling[key] = &fill; filling = true; }
+            if (hit) { trace(TR_DONE, id); if (co_await co_write(cl, reply.data(), reply.size(), io_timeout_s) != ssize_t(reply.size())) break; continue; }
+        }
+        vtime_t est = 0, took = 0; size_t idx = pick_backend<P>(req[0], base, est);
+        if (idx == SIZE_MAX) { if (filling) co_cache_settle(r, key, fill, nullptr); shed(cl.fd); if (shed_reply) continue; break; }
+        trace(TR_PICKED, id, idx);
+        int rc = RELAY_RETRY;
+        for (int attempt = 0;; ++attempt) {
+            CoUp* u = co_await co_checkout(r, idx, queue_rank(req[0], est, t0), id); rc = RELAY_RETRY; bool timed = false;
+            if (u) {
+                trace(TR_CHECKOUT, id, idx);
+                Steady::time_point sent = Steady::now(), first = sent;
+                ssize_t w = co_await co_write(u->sock, req, 2, io_timeout_s); timed = w == CO_TIMEDOUT;
+                if (w == 2) { trace(TR_SENT, id, idx); reply.clear(); rc = co_await co_relay(*u, cl, reply_len, first, timed, id, idx, filling ? &reply : nullptr); took = to_ticks(first - sent); }
+                if (timed) backend_timeout(idx);
+                co_checkin(r, idx, *u, rc >= RELAY_RETRY);
+            }
+            if (rc != RELAY_RETRY || attempt) break;
+            idx = retry_backend<P>(req[0], base, idx, est);
+        }
+        if (filling) co_cache_settle(r, key, fill, rc < RELAY_RETRY && reply.size() == reply_len ? &reply : nullptr);
+        sched.done(idx); trace(TR_DONE, id, idx);
+        if (rc < RELAY_RETRY) { sched.observe(idx, req[0], base, took); sched.settle(idx, est, took, now_ticks()); health_pass(idx); }
+        else sched.cancel(idx, est, now_ticks());
+        alloc_check();
+        if (rc == RELAY_OK) { vtime_t total = to_ticks(Steady::now() - t0); metrics.latency(idx, req[0], total - took, took, total); }
+        else { if (rc >= RELAY_RETRY) metrics.count(idx, BC_FAILURES); break; }
+    } while (keepalive);
+    metrics.count(GC_CLOSES);      // cl closes on the way out
+}
+
+// Queues every coroutine whose socket wait is past its deadline to be resumed.
+static void co_expire(CoReactor& r) {
+    Steady::time_point now = Steady::now();
+    for (CoReactor::Slot& sl : r.slots) {
+        CoSock* s = sl.s;
+        if (!s || (!s->reader && !s->writer) || s->deadline > now) continue;
+        s->expired = true;
+        if (s->reader) r.ready.push_back(std::exchange(s->reader, nullptr));
+        if (s->writer) r.ready.push_back(std::exchange(s->writer, nullptr));
+    }
+}
+
+// false if built without coroutine support, so the caller can run epoll instead
+template <class P> static bool coro_loop(const std::vector<int>& listen_fds) {
+    CoReactor r; r.epfd = epoll_create1(EPOLL_CLOEXEC); if (r.epfd < 0) { perror("epoll_create1"); return true; }
+    r.pools = std::vector<CoPool>(backends.size());    // not resize(): that would copy‑construct
+    for (CoPool& p : r.pools) p.waiting.reserve(SLAB_PREFILL);
+    for (CoPool& p : r.pools) while (p.conns.size() < reactor_pool_max) p.conns.emplace_back(new CoUp);
+    if (cache.on()) r.filling.assign(ReplyCache::KEYS, nullptr);
+    for (int fd : listen_fds) { epoll_event ev{}; ev.events = EPOLLIN | EPOLLEXCLUSIVE; ev.data.u64 = CO_LISTENER | uint32_t(fd); epoll_ctl(r.epfd, EPOLL_CTL_ADD, fd, &ev); }
+    bool accepting = true;
+    epoll_event evs[256]; Steady::time_point next_reap = Steady::now() + std::chrono::seconds(1);
+    bool deadlines = connect_timeout_s > 0 || io_timeout_s > 0;
+    while (true) {
+        int n = epoll_wait(r.epfd, evs, 256, deadlines ? EXPIRE_MS : 1000);
+        if (n < 0) { if (errno == EINTR) continue; perror("epoll_wait"); return true; }
+        for (int i = 0; i < n; ++i) {
+            uint64_t d = evs[i].data.u64; uint32_t e = evs[i].events;
+            if ((d & CO_LISTENER) == CO_LISTENER) {
+                for (int cfd; (cfd = accept4(int(uint32_t(d)), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0;) { metrics.count(GC_ACCEPTS); tune_client(cfd); co_client<P>(r, cfd); }
+                continue;
+            }
+            uint32_t id = uint32_t(d), gen = uint32_t(d >> 32);
+            auto live = [&]{ return id < r.slots.size() && r.slots[id].gen == gen && r.slots[id].s; };
+            if (live() && (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                CoSock* s = r.slots[id].s;
+                if (s->reader) std::exchange(s->reader, nullptr).resume();
+                else if (s->idle) s->close();                   // idle upstream closed by the server
+            }
+            if (live() && (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && r.slots[id].s->writer) std::exchange(r.slots[id].s->writer, nullptr).resume();
+        }
+        if (deadlines) co_expire(r);
+        while (!r.ready.empty()) { auto h = r.ready.front(); r.ready.pop_front(); h.resume(); }
+        if (Steady::now() >= next_reap) {
+            Steady::time_point now = Steady::now();
+            for (size_t b = 0; b < r.pools.size(); ++b) {
+                Steady::time_point cutoff = idle_cutoff(b, now);
+                for (auto& u : r.pools[b].conns) if (!u->busy && u->sock.fd != -1 && u->last_used < cutoff) u->sock.close();
+            }
+            next_reap = now + std::chrono::seconds(1);
+        }
+        if (accepting && upgrading.load(std::memory_order_relaxed)) {
+            for (int fd : listen_fds) epoll_ctl(r.epfd, EPOLL_CTL_DEL, fd, nullptr);
+            accepting = false; acceptors_running.fetch_sub(1);
+        }
+    }
+}
+#else
+template <class P> static bool coro_loop(const std::vector<int>&) { std::cerr << "[LB] built without C++20 coroutines, using epoll\n"; return false; }
+#endif
+
+/* ───────────── cluster ─────────────
+ * LBs in front of the same backends share their load.  Every
+ * --gossip-interval each node sends each --peer one UDP datagram per
+ * GOSSIP_CHUNK backends, holding how far it moved each backend's vfinish
+ * since the last round (charges, minus settle and cancel corrections), and
+ * merges what its peers send as if it had made those picks itself (see
+ * SchedTable::merge).  A node's view of the others is thus at most one
+ * interval and one datagram stale, and a lost datagram's share drains away
+ * on its own once vfinish falls behind now.  Datagrams carry a hash of the
+ * live backend slots, so nodes configured differently ignore each other
+ * (nodes that reload must reload alike); fields are big‑endian.  Health is
+ * still judged by each node alone.
+ */
+static std::vector<sockaddr_in> peers;
+static int cluster_port = 0;                    // 0: any, the node only sends
+static double gossip_interval_s = 0.05;
+static const uint32_t GOSSIP_MAGIC = 0x534c4231;    // "SLB1"
+static const size_t GOSSIP_CHUNK = 1024;
+struct GossipHead { uint32_t magic, topo, node, first, count; };    // then count int64 moves
+
+static std::atomic<uint32_t> cluster_topo{0};   // topology_hash(), redone by a reload
+static uint32_t topology_hash() {
+    uint32_t h = 2166136261u;
+    auto mix = [&](const std::string& x) { for (unsigned char ch : x) { h ^= ch; h *= 16777619u; } h ^= 0xff; h *= 16777619u; };
+    mix(std::to_string(backends.size()));
+    for (size_t i = 0; i < backends.size(); ++i) if (backend_live(i)) { const Backend& b = backends[i]; mix(std::to_string(i)); mix(roles().names[b.role]); mix(b.ip + ":" + std::to_string(b.port)); }
+    return h;
+}
+static void gossip_sender(int s, uint32_t node) {
+    place_thread(TC_AUX);
+    std::vector<char> buf(sizeof(GossipHead) + GOSSIP_CHUNK * 8);
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(gossip_interval_s));
+        for (size_t first = 0; first < sched.n; first += GOSSIP_CHUNK) {
+            size_t count = std::min(GOSSIP_CHUNK, sched.n - first); bool moved = false;
+            for (size_t k = 0; k < count; ++k) {
+                vtime_t d = sched.take_shared(first + k); moved |= d != 0;
+                uint64_t be = htobe64(uint64_t(d)); std::memcpy(&buf[sizeof(GossipHead) + 8 * k], &be, 8);
+            }
+            if (!moved) continue;
+            GossipHead h{ htonl(GOSSIP_MAGIC), htonl(cluster_topo.load(std::memory_order_relaxed)), htonl(node), htonl(uint32_t(first)), htonl(uint32_t(count)) };
+            std::memcpy(buf.data(), &h, sizeof(h));
+            for (const sockaddr_in& p : peers)
+                if (sendto(s, buf.data(), sizeof(h) + 8 * count, 0, (const sockaddr*)&p, sizeof(p)) > 0) metrics.count(GC_GOSSIP_SENT);
+        }
+    }
+}
+static void gossip_receiver(int s, uint32_t node) {
+    place_thread(TC_AUX);
+    std::vector<char> buf(sizeof(GossipHead) + GOSSIP_CHUNK * 8);
+    while (true) {
+        ssize_t n = recv(s, buf.data(), buf.size(), 0); if (n < ssize_t(sizeof(GossipHead))) continue;
+        GossipHead h; std::memcpy(&h, buf.data(), sizeof(h));
+        size_t first = ntohl(h.first), count = ntohl(h.count);
+        if (ntohl(h.magic) != GOSSIP_MAGIC || ntohl(h.topo) != cluster_topo.load(std::memory_order_relaxed) || ntohl(h.node) == node) continue;
+        if (count > GOSSIP_CHUNK || first + count > sched.n || size_t(n) != sizeof(h) + 8 * count) continue;
+        metrics.count(GC_GOSSIP_RECEIVED); vtime_t now = now_ticks();
+        for (size_t k = 0; k < count; ++k) { uint64_t be; std::memcpy(&be, &buf[sizeof(h) + 8 * k], 8); sched.merge(first + k, vtime_t(be64toh(be)), now); }
+    }
+}
+// Once sched is set up: binds the gossip socket and starts sharing; false if the socket cannot be had.
+static bool cluster_start() {
+    int s = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0), opt = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));    // an upgrade's new process binds it while this one drains
+    sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_addr.s_addr = INADDR_ANY; addr.sin_port = htons(uint16_t(cluster_port));
+    if (s < 0 || bind(s, (sockaddr*)&addr, sizeof(addr)) < 0) { perror("cluster"); return false; }
+    uint32_t node = uint32_t(getpid()) ^ uint32_t(Steady::now().time_since_epoch().count());
+    cluster_topo = topology_hash(); sched.share_moves();
+    std::thread(gossip_sender, s, node).detach(); std::thread(gossip_receiver, s, node).detach();
+    std::cerr << "[LB] sharing load with " << peers.size() << " peer(s)\n";
+    return true;
+}
+
+/* Prometheus scrape endpoint: answers every connection with the current dump,
+ * plus scheduler gauges that live outside the metric shards; GET /trace
+ * answers with the trace rings instead (load it in ui.perfetto.dev or
+ * chrome://tracing). */
+static void metrics_server(int port) {
+    place_thread(TC_METRICS);
+    int s=socket(AF_INET,SOCK_STREAM|SOCK_CLOEXEC,0); int opt=1; setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt)); setsockopt(s,SOL_SOCKET,SO_REUSEPORT,&opt,sizeof(opt));
+    sockaddr_in addr{}; addr.sin_family=AF_INET; addr.sin_addr.s_addr=INADDR_ANY; addr.sin_port=htons(port);
+    if(s<0||bind(s,(sockaddr*)&addr,sizeof(addr))<0||listen(s,16)<0){perror("metrics");return;}
+    static const char* types[CostModel::TYPES] = { "M", "V", "P", "other" };
+    while(true){
+        int c=accept(s,nullptr,nullptr); if(c<0) continue;
+        char req[1024]; ssize_t got=recv(c,req,sizeof(req),0);
+        if(got>=10&&std::strncmp(req,"GET /trace",10)==0){
+            std::string body=tracer.dump(), head="HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: "+std::to_string(body.size())+"\r\n\r\n";
+            write_n(c,head.data(),head.size()); write_n(c,body.data(),body.size()); close(c); continue;
+        }
+        std::string body=metrics.render(); char line[256];
+        body+="# TYPE lb_backend_backlog_seconds gauge\n# TYPE lb_backend_active gauge\n# TYPE lb_backend_up gauge\n";
+        vtime_t now=now_ticks(); std::vector<std::string> names=metrics.names_now();
+        for(size_t i=0;i<sched.n;++i){
+            if(names[i].empty()) continue;
+            vtime_t vf=sched.vfinish[i].load(std::memory_order_relaxed); bool up=sched.up(i);
+            std::snprintf(line,sizeof(line),"lb_backend_backlog_seconds{backend=\"%s\"} %.6f\nlb_backend_active{backend=\"%s\"} %u\nlb_backend_up{backend=\"%s\"} %d\n",names[i].c_str(),up&&vf>now?double(vf-now)/VT_PER_SEC:0.0,names[i].c_str(),sched.s[i].active.load(std::memory_order_relaxed),names[i].c_str(),int(up)); body+=line;
+        }
+        body+="# TYPE lb_cost_seconds_per_unit gauge\n";
+        for(int t=0;t<CostModel::TYPES;++t) for(size_t r=0;r<roles().names.size();++r){
+            std::snprintf(line,sizeof(line),"lb_cost_seconds_per_unit{type=\"%s\",role=\"%s\"} %.6f\n",types[t],roles().names[r].c_str(),double(sched.model.unit[t][r].load(std::memory_order_relaxed))/VT_PER_SEC); body+=line;
+        }
+        std::string head="HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "+std::to_string(body.size())+"\r\n\r\n";
+        write_n(c,head.data(),head.size()); write_n(c,body.data(),body.size()); close(c);
+    }
+}
+
+static bool parse_addr(const std::string& s, std::string& ip, uint16_t& port) {
+    size_t colon=s.rfind(':'); if(colon==std::string::npos) return false;
+    ip=s.substr(0,colon); int p=std::atoi(s.c_str()+colon+1); in_addr a;
+    if(p<=0||p>65535||inet_pton(AF_INET,ip.c_str(),&a)!=1) return false;
+    port=uint16_t(p); return true;
+}
+
+static std::string listen_addr="0.0.0.0:80";
+
+static int open_listener(const std::string& where, int backlog, bool nonblock) {
+    std::string ip; uint16_t port; if(!parse_addr(where,ip,port)){std::cerr<<"[LB] bad listen address "<<where<<"\n";return -1;}
+    int fd=socket(AF_INET,SOCK_STREAM|SOCK_CLOEXEC|(nonblock?SOCK_NONBLOCK:0),0); if(fd<0){perror("socket");return -1;}
+    int opt=1; setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt)); setsockopt(fd,SOL_SOCKET,SO_REUSEPORT,&opt,sizeof(opt)); tune_listener(fd);
+    sockaddr_in addr{}; addr.sin_family=AF_INET; inet_pton(AF_INET,ip.c_str(),&addr.sin_addr); addr.sin_port=htons(port);
+    if(bind(fd,(sockaddr*)&addr,sizeof(addr))<0){perror("bind");close(fd);return -1;}
+    if(listen(fd,backlog)<0){perror("listen");close(fd);return -1;}
+    return fd;
+}
+
+/* ───────────── worker pool ─────────────
+ * --workers=N fixed threads run handle_client instead of a detached thread per
+ * connection.  Each worker has a Chase–Lev deque filled by one acceptor (worker
+ * w belongs to acceptor w % listeners, the deque's only pusher); workers take
+ * from their own deque first, steal from the others when it is empty, and park
+ * on cv once every deque is. */
+struct WorkerPool {
+    std::vector<std::unique_ptr<WsDeque<int>>> q;
+    std::atomic<int> idle{0};
+    std::mutex mtx; std::condition_variable cv;
+};
+static WorkerPool workers;
+static int nworkers = 64;               // 0: thread per connection
+
+static bool worker_take(size_t self, int& fd) {
+    size_t n = workers.q.size();
+    for (size_t k = 0; k < n; ++k) { WsDeque<int>& d = *workers.q[(self + k) % n]; while (!d.empty()) if (d.steal(fd)) return true; }
+    return false;
+}
+
+template <class P> static void worker_loop(size_t self) {
+    place_thread(TC_WORKER, self);
+    int fd;
+    while (true) {
+        if (worker_take(self, fd)) { handle_client<P>(fd); continue; }
+        std::unique_lock<std::mutex> g(workers.mtx);
+        workers.idle.fetch_add(1, std::memory_order_seq_cst);
+        bool got = worker_take(self, fd);       // recheck after announcing; pairs with the fence in worker_submit
+        if (!got) workers.cv.wait(g);
+        workers.idle.fetch_sub(1, std::memory_order_relaxed);
+        g.unlock();
+        if (got) handle_client<P>(fd);
+    }
+}
+
+// Round‑robin over the acceptor's own deques; if all are full the acceptor
+// serves the client itself, which stops it accepting until the pool catches up.
+template <class P> static void worker_submit(size_t acceptor, size_t acceptors, size_t& next, int fd) {
+    size_t mine = (workers.q.size() - acceptor + acceptors - 1) / acceptors;
+    bool queued = false;
+    for (size_t k = 0; k < mine && !queued; ++k, ++next) queued = workers.q[acceptor + (next % mine) * acceptors]->push(fd);
+    if (!queued) { handle_client<P>(fd); return; }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (workers.idle.load(std::memory_order_relaxed) > 0) { std::lock_guard<std::mutex> g(workers.mtx); workers.cv.notify_one(); }
+}
+
+/* Threaded engine acceptor: client fds stay blocking for handle_client.
+ * After an upgrade the control thread interrupts its accept with SIGRTMIN
+ * (a no‑op handler without SA_RESTART) until it has stopped. */
+static std::mutex acceptor_mtx;
+static std::vector<pthread_t> acceptor_threads;     // acceptor_mtx; those still accepting
+template <class P> static void accept_loop(int listen_fd, size_t acceptor, size_t acceptors) {
+    steer_listener(listen_fd,place_thread(TC_ACCEPTOR,acceptor));
+    { std::lock_guard<std::mutex> g(acceptor_mtx); acceptor_threads.push_back(pthread_self()); }
+    size_t next=0;
+    while(!upgrading.load(std::memory_order_relaxed)){
+        int cfd=accept4(listen_fd,nullptr,nullptr,SOCK_CLOEXEC); if(cfd<0){if(errno!=EINTR)perror("accept");continue;} metrics.count(GC_ACCEPTS); tune_client(cfd);
+        if(workers.q.empty()) std::thread([cfd]{ place_thread(TC_WORKER); handle_client<P>(cfd); }).detach(); else worker_submit<P>(acceptor,acceptors,next,cfd);
+    }
+    std::lock_guard<std::mutex> g(acceptor_mtx);
+    acceptor_threads.erase(std::find(acceptor_threads.begin(),acceptor_threads.end(),pthread_self())); acceptors_running.fetch_sub(1);
+}
+
+template <class P> static int serve(const std::string& engine, int reactors, const std::vector<int>& listeners) {
+    std::vector<std::thread> ts; redispatch = retry_backend<P>;
+    bool reactor_engine=engine=="epoll"||engine=="uring"||engine=="coro";
+    acceptors_running=reactor_engine?reactors:int(listeners.size());
+    if(reactor_engine){
+        std::cout<<"[LB] SmartLB listening on "<<listen_addr<<" ("<<engine<<", "<<reactors<<" reactor(s), "<<listeners.size()<<" listener(s), "<<P::name()<<")\n";
+        // reactor i owns listeners i, i+reactors, ...; with fewer listeners than reactors they share (EPOLLEXCLUSIVE)
+        for(int i=0;i<reactors;++i){
+            std::vector<int> mine; for(size_t k=i%listeners.size();k<listeners.size();k+=reactors) mine.push_back(listeners[k]);
+            bool uring=engine=="uring", coro=engine=="coro";
+            bool own=listeners.size()>=size_t(reactors);
+            ts.emplace_back([mine,i,own,uring,coro]{
+                int cpu=place_thread(TC_REACTOR,size_t(i)); if(own) for(int fd:mine) steer_listener(fd,cpu);
+                if(uring&&uring_loop<P>(mine)) return;
+                if(coro&&coro_loop<P>(mine)) return;
+                if(uring) for(int fd:mine) fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+                reactor_loop<P>(mine);
+            });
+        }
+    } else {
+        std::cout<<"[LB] SmartLB listening on "<<listen_addr<<" ("<<listeners.size()<<" listener(s), "<<nworkers<<" worker(s), "<<P::name()<<")\n";
+        std::thread(pool_reaper).detach();
+        for(int w=0;w<nworkers;++w) workers.q.emplace_back(new WsDeque<int>(1024));
+        for(int w=0;w<nworkers;++w) std::thread(worker_loop<P>,size_t(w)).detach();
+        for(size_t i=0;i<listeners.size();++i) ts.emplace_back(accept_loop<P>,listeners[i],i,listeners.size());
+    }
+    for(auto& t:ts) t.join();
+    if(upgrading) while(true) std::this_thread::sleep_for(std::chrono::seconds(1));    // acceptors stopped; control_loop exits once drained
+    return 1;
+}
+
+/* --config=FILE holds one option per line, as on the command line without the
+ * leading "--" ("engine epoll", "pool 4", "pin"), and two topology lines:
+ *   backend ROLE IP:PORT [WEIGHT]
+ *   role NAME M=2 V=1 P=1 other=1
+ * '#' starts a comment.  Command‑line options are applied after the file. */
+static bool load_config(const std::string& path, std::vector<std::string>& args) {
+    std::ifstream in(path); if(!in){std::cerr<<"[LB] cannot open config "<<path<<"\n";return false;}
+    std::string line; int ln=0;
+    while(std::getline(in,line)){ ++ln;
+        std::istringstream ls(line.substr(0,line.find('#'))); std::string key,w; std::vector<std::string> v;
+        if(!(ls>>key)) continue;
+        while(ls>>w) v.push_back(w);
+        if(key=="backend"&&(v.size()==2||v.size()==3)) args.push_back("--backend="+v[0]+"@"+v[1]+(v.size()==3?"/"+v[2]:""));
+        else if(key=="role"&&!v.empty()){ std::string a="--role="+v[0]; for(size_t i=1;i<v.size();++i) a+=(i==1?":":",")+v[i]; args.push_back(a); }
+        else if(key!="backend"&&key!="role"&&key!="config"&&v.size()<=1) args.push_back("--"+key+(v.empty()?"":"="+v[0]));
+        else {std::cerr<<"[LB] "<<path<<":"<<ln<<": cannot parse '"<<line<<"'\n";return false;}
+    }
+    return true;
+}
+
+// Options from every --config file, then the rest of the command line.
+static bool gather_args(const std::vector<std::string>& argv, std::vector<std::string>& args) {
+    for(size_t i=1;i<argv.size();++i) if(argv[i].compare(0,9,"--config=")==0&&!load_config(argv[i].substr(9),args)) return false;
+    for(size_t i=1;i<argv.size();++i) if(argv[i].compare(0,9,"--config=")!=0) args.push_back(argv[i]);
+    return true;
+}
+// no topology given: the original three-server lab setup
+static const char* const DEFAULT_BACKENDS[] = { "VIDEO@192.168.0.101:80", "VIDEO@192.168.0.102:80", "MUSIC@192.168.0.103:80" };
+
+// ROLE@IP:PORT[/WEIGHT]
+struct BackendSpec { Role role; std::string ip; uint16_t port; uint32_t weight; };
+static bool parse_backend(const std::string& spec, BackendSpec& b) {
+    size_t at=spec.find('@'), slash=spec.find('/',at); if(at==std::string::npos){std::cerr<<"[LB] bad backend "<<spec<<"\n";return false;}
+    int role=roles().find(spec.substr(0,at));
+    if(role<0){std::cerr<<"[LB] unknown role in backend "<<spec<<"\n";return false;}
+    if(!parse_addr(spec.substr(at+1,slash==std::string::npos?std::string::npos:slash-at-1),b.ip,b.port)){std::cerr<<"[LB] bad backend address "<<spec<<"\n";return false;}
+    b.role=Role(role); b.weight=slash==std::string::npos?1:uint32_t(std::max(1,std::atoi(spec.c_str()+slash+1)));
+    return true;
+}
+static bool add_backend(const std::string& spec) {
+    BackendSpec b; if(!parse_backend(spec,b)) return false;
+    backends.emplace_back(b.role,b.ip,b.port); backends.back().weight=b.weight;
+    return true;
+}
+
+/* ───────────── reload and upgrade ─────────────
+ * Signals are blocked in every thread and taken by control_loop.
+ *
+ * SIGHUP re-reads the --config files and the command line for the backend
+ * list and applies it to the fixed table of --max-backends slots, so no
+ * engine array or pick ever sees the table move: a backend still listed
+ * keeps its slot; a new one takes the slot it had before, if it was removed
+ * earlier, else a vacant one, else one whose backend is gone and has no
+ * connection left open, and is placed in its role's heap and reinstated; one
+ * no longer listed is retired (SchedTable::set_retired), so nothing new is
+ * sent to it, requests queued for its connections move elsewhere as on an
+ * ejection, and those in flight finish.  Once none is active it is drained;
+ * the reapers close its idle connections.  The reload is all or nothing: if
+ * any listed backend finds no slot, nothing changes.  Role lines and the
+ * rest of the options are read at startup only, and wrr keeps its startup
+ * rotation (a backend in a slot vacant at startup gets weight 1 in it).
+ *
+ * SIGUSR2 starts the same command again (argv[0], looked up on PATH, so a
+ * rebuilt binary is what runs) with the listening sockets inherited and
+ * named in LB_LISTEN_FDS.  Once the new process reports it is serving,
+ * through the pipe in LB_READY_FD, this one stops accepting, serves the
+ * clients it has, and exits when they are gone or after --drain-timeout.
+ * If the new process does not come up within UPGRADE_WAIT_S, this one
+ * carries on. */
+static std::vector<std::string> saved_argv;
+static std::vector<int> listen_fds;
+static size_t max_backends = 0;                 // 0: as many as configured
+static double drain_timeout_s = 30;
+static const int UPGRADE_WAIT_S = 10;
+static Steady::time_point drain_deadline;
+
+static std::string backend_name(const Backend& b) { return b.ip+":"+std::to_string(b.port); }
+
+// A gone backend's slot can take another once nothing of the old one is left:
+// no request charged to it and no connection open to it in any engine.
+static bool slot_free(size_t i) { return backends[i].state==B_GONE&&!sched.s[i].active.load()&&!backends[i].open.load(); }
+
+static void reload_backends() {
+    std::vector<std::string> args, specs; std::vector<BackendSpec> want;
+    if(!gather_args(saved_argv,args)){ std::cerr<<"[LB] reload failed, backends unchanged\n"; return; }
+    for(const std::string& a:args) if(a.compare(0,10,"--backend=")==0) specs.push_back(a.substr(10));
+    if(specs.empty()) specs.assign(std::begin(DEFAULT_BACKENDS),std::end(DEFAULT_BACKENDS));
+    for(const std::string& sp:specs){ BackendSpec b; if(!parse_backend(sp,b)){ std::cerr<<"[LB] reload failed, backends unchanged\n"; return; } want.push_back(b); }
+    // slot for each wanted backend: the one it has or had, else a free one; all of them
+    // are found before anything changes, so a reload short of slots leaves no role emptied
+    std::vector<size_t> at(want.size(),SIZE_MAX); std::vector<bool> claimed(backends.size(),false); bool fits=true;
+    for(size_t k=0;k<want.size();++k)
+        for(size_t i=0;i<backends.size()&&at[k]==SIZE_MAX;++i){ const Backend& b=backends[i];
+            if(!claimed[i]&&b.state!=B_VACANT&&b.role==want[k].role&&b.ip==want[k].ip&&b.port==want[k].port){ at[k]=i; claimed[i]=true; } }
+    for(size_t k=0;k<want.size();++k){
+        for(size_t i=0;i<backends.size()&&at[k]==SIZE_MAX;++i) if(!claimed[i]&&backends[i].state==B_VACANT){ at[k]=i; claimed[i]=true; }
+        for(size_t i=0;i<backends.size()&&at[k]==SIZE_MAX;++i) if(!claimed[i]&&slot_free(i)){ at[k]=i; claimed[i]=true; }
+        if(at[k]==SIZE_MAX){ std::cerr<<"[LB] reload: no free slot for "<<want[k].ip<<":"<<want[k].port<<" (--max-backends="<<backends.size()<<")\n"; fits=false; }
+    }
+    if(!fits){ std::cerr<<"[LB] reload failed, backends unchanged\n"; return; }
+    vtime_t now=now_ticks();
+    for(size_t k=0;k<want.size();++k){
+        size_t i=at[k];
+        Backend& b=backends[i]; uint8_t was=b.state.load();
+        b.weight=want[k].weight; sched.s[i].weight=want[k].weight;
+        if(was==B_LIVE) continue;
+        bool fresh=was==B_VACANT||b.role!=want[k].role||b.ip!=want[k].ip||b.port!=want[k].port;
+        if(fresh){
+            b.role=want[k].role; b.ip=want[k].ip; b.port=want[k].port;
+            b.addr.sin_port=htons(b.port); inet_pton(AF_INET,b.ip.c_str(),&b.addr.sin_addr);
+            sched.place(i,b.role,uint32_t(b.pool_max),b.weight); metrics.rename(i,backend_name(b));
+        }
+        b.fails=0; b.rises=0; b.req_fails=0;
+        b.state.store(B_LIVE,std::memory_order_release); sched.set_retired(i,false,now);
+        std::cerr<<"[LB] backend "<<backend_name(b)<<(fresh?" added":" back")<<"\n";
+    }
+    for(size_t i=0;i<backends.size();++i) if(!claimed[i]&&backends[i].state==B_LIVE){
+        backends[i].state.store(B_DRAINING,std::memory_order_release); sched.set_retired(i,true,now);
+        std::cerr<<"[LB] backend "<<backend_name(backends[i])<<" draining\n";
+    }
+    cluster_topo=topology_hash();
+}
+static void finish_drains() {
+    for(size_t i=0;i<backends.size();++i) if(backends[i].state==B_DRAINING&&!sched.s[i].active.load()){
+        backends[i].state.store(B_GONE,std::memory_order_release); std::cerr<<"[LB] backend "<<backend_name(backends[i])<<" drained\n";
+    }
+}
+
+static void start_upgrade() {
+    if(upgrading) return;
+    // everything the child needs is built here: between fork and exec only async‑signal‑safe calls
+    int ready[2]; if(pipe(ready)<0){perror("upgrade");return;}
+    fcntl(ready[0],F_SETFD,FD_CLOEXEC);
+    std::string fds; for(int fd:listen_fds){ fds+=(fds.empty()?"":",")+std::to_string(fd); fcntl(fd,F_SETFD,0); }
+    std::vector<std::string> env{ "LB_LISTEN_FDS="+fds, "LB_READY_FD="+std::to_string(ready[1]) };
+    for(char** e=environ;*e;++e) if(std::strncmp(*e,"LB_LISTEN_FDS=",14)&&std::strncmp(*e,"LB_READY_FD=",12)) env.push_back(*e);
+    std::vector<char*> av, ev;
+    for(std::string& a:saved_argv) av.push_back(&a[0]);
+    for(std::string& e:env) ev.push_back(&e[0]);
+    av.push_back(nullptr); ev.push_back(nullptr);
+    pid_t pid=fork();
+    if(pid==0){ if(placing) sched_setaffinity(0,sizeof(startup_cpus),&startup_cpus); execvpe(av[0],av.data(),ev.data()); _exit(127); }   // not this thread's aux CPUs
+    close(ready[1]); for(int fd:listen_fds) fcntl(fd,F_SETFD,FD_CLOEXEC);
+    if(pid<0){perror("upgrade");close(ready[0]);return;}
+    pollfd p{ready[0],POLLIN,0}; char c=0;
+    bool ok=poll(&p,1,UPGRADE_WAIT_S*1000)==1&&read(ready[0],&c,1)==1;
+    close(ready[0]);
+    if(!ok){ std::cerr<<"[LB] upgrade: process "<<pid<<" did not come up, still serving\n"; kill(pid,SIGTERM); waitpid(pid,nullptr,0); return; }
+    std::cerr<<"[LB] upgrade: process "<<pid<<" serving, draining this one\n";
+    drain_deadline=Steady::now()+std::chrono::duration_cast<Steady::duration>(std::chrono::duration<double>(drain_timeout_s));
+    upgrading=true;
+}
+static void on_wake(int) {}
+static void control_loop(sigset_t set) {
+    place_thread(TC_AUX);
+    timespec tick{1,0};
+    while(true){
+        int sig=sigtimedwait(&set,nullptr,&tick);
+        if(sig==SIGHUP) reload_backends(); else if(sig==SIGUSR2) start_upgrade();
+        finish_drains();
+        if(!upgrading) continue;
+        { std::lock_guard<std::mutex> g(acceptor_mtx); for(pthread_t t:acceptor_threads) pthread_kill(t,SIGRTMIN); }
+        if(acceptors_running>0) continue;
+        uint64_t open=metrics.total(GC_ACCEPTS)-metrics.total(GC_CLOSES);
+        if(open&&Steady::now()<drain_deadline) continue;
+        std::cerr<<"[LB] drained"<<(open?" (timed out)":"")<<", exiting\n"; std::cout.flush();
+        _exit(0);
+    }
 }
 
-int main(){ start_ts=Steady::now(); backends.reserve(3); backends.emplace_back(Backend::VIDEO,"192.168.0.101",80); backends.emplace_back(Backend::VIDEO,"192.168.0.102",80); backends.emplace_back(Backend::MUSIC,"192.168.0.103",80);
-    int listen_fd=socket(AF_INET,SOCK_STREAM,0); if(listen_fd<0){perror("socket");return 1;} int opt=1; setsockopt(listen_fd,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt)); sockaddr_in addr{}; addr.sin_family=AF_INET; addr.sin_addr.s_addr=INADDR_ANY; addr.sin_port=htons(80); if(bind(listen_fd,(sockaddr*)&addr,sizeof(addr))<0){perror("bind");return 1;} if(listen(listen_fd,128)<0){perror("listen");return 1;}
-    std::cout<<"[LB] SmartLB listening on 0.0.0.0:80\n";
-    while(true){int cfd=accept(listen_fd,nullptr,nullptr); if(cfd<0){perror("accept");continue;} std::thread(handle_client,cfd).detach();}
+int main(int argc, char** argv){ start_ts=Steady::now(); signal(SIGPIPE,SIG_IGN);
+    std::vector<std::string> args, backend_specs;
+    saved_argv.assign(argv,argv+argc); if(!gather_args(saved_argv,args)) return 1;
+    if(sched_getaffinity(0,sizeof(startup_cpus),&startup_cpus)!=0){ CPU_ZERO(&startup_cpus); for(unsigned c=0;c<std::max(1u,std::thread::hardware_concurrency());++c) CPU_SET(c,&startup_cpus); }
+    std::string engine="threads", policy="serpt", weights; int reactors=1; int pool=1; int metrics_port=0; int nlisteners=0, backlog=128; bool pin=false; size_t index_min=SchedTable::INDEX_MIN;
+    for(const std::string& a:args){
+        if(a.compare(0,9,"--engine=")==0) engine=a.substr(9); else if(a.compare(0,11,"--reactors=")==0) reactors=std::atoi(a.c_str()+11);
+        else if(a.compare(0,7,"--pool=")==0) pool=std::atoi(a.c_str()+7); else if(a.compare(0,12,"--pool-idle=")==0) pool_idle_s=std::atof(a.c_str()+12);
+        else if(a.compare(0,11,"--pipeline=")==0) pipeline_depth=std::max(1,std::atoi(a.c_str()+11));
+        else if(a=="--keepalive") keepalive=16; else if(a.compare(0,12,"--keepalive=")==0) keepalive=size_t(std::max(0,std::atoi(a.c_str()+12)));
+        else if(a.compare(0,9,"--policy=")==0) policy=a.substr(9); else if(a.compare(0,10,"--weights=")==0) weights=a.substr(10);
+        else if(a.compare(0,11,"--adaptive=")==0) sched.model.alpha=std::atof(a.c_str()+11); else if(a.compare(0,12,"--index-min=")==0) index_min=size_t(std::max(1,std::atoi(a.c_str()+12)));
+        else if(a.compare(0,15,"--metrics-port=")==0) metrics_port=std::atoi(a.c_str()+15);
+        else if(a.compare(0,12,"--listeners=")==0) nlisteners=std::atoi(a.c_str()+12); else if(a.compare(0,10,"--backlog=")==0) backlog=std::atoi(a.c_str()+10);
+        else if(a.compare(0,10,"--workers=")==0) nworkers=std::max(0,std::atoi(a.c_str()+10));
+        else if(a=="--pin") pin=true; else if(a.compare(0,7,"--cpus=")==0){
+            size_t colon=a.find(':',7); int c=0; while(c<THREAD_CLASSES&&a.compare(7,colon==std::string::npos?std::string::npos:colon-7,THREAD_CLASS_NAMES[c])!=0) ++c;
+            std::vector<int> cpus; if(colon==std::string::npos||c==THREAD_CLASSES||!parse_cpus(a.substr(colon+1),cpus)){ std::cerr<<"[LB] bad "<<a<<" (want CLASS:LIST, e.g. reactor:0-3 or worker:node1)\n"; return 1; }
+            class_cpus[c]=cpus; }
+        else if(a.compare(0,12,"--reply-len=")==0) reply_len=std::max(1,std::atoi(a.c_str()+12));
+        else if(a.compare(0,9,"--listen=")==0) listen_addr=a.substr(9);
+        else if(a.compare(0,18,"--health-interval=")==0) health_interval_s=std::atof(a.c_str()+18); else if(a.compare(0,17,"--health-timeout=")==0) health_timeout_s=std::atof(a.c_str()+17);
+        else if(a.compare(0,18,"--connect-timeout=")==0) connect_timeout_s=std::atof(a.c_str()+18); else if(a.compare(0,13,"--io-timeout=")==0) io_timeout_s=std::atof(a.c_str()+13);
+        else if(a.compare(0,11,"--max-wait=")==0) max_wait=vtime_t(std::atof(a.c_str()+11)*VT_PER_SEC); else if(a.compare(0,13,"--max-active=")==0) max_active=uint32_t(std::max(0,std::atoi(a.c_str()+13)));
+        else if(a.compare(0,15,"--max-inflight=")==0) max_inflight=uint32_t(std::max(0,std::atoi(a.c_str()+15)));
+        else if(a=="--shed=rst"||a=="--shed=reply") shed_reply=a=="--shed=reply";
+        else if(a=="--queue=srpt"||a=="--queue=fifo") sched.order.fifo=a=="--queue=fifo"; else if(a.compare(0,14,"--queue-aging=")==0) sched.order.aging=std::max(0.0,std::atof(a.c_str()+14));
+        else if(a.compare(0,11,"--deadline=")==0){ if(!sched.order.set_deadline(a.substr(11))){std::cerr<<"[LB] bad deadline "<<a.substr(11)<<"\n";return 1;} }
+        else if(a.compare(0,14,"--health-fall=")==0) health_fall=std::max(1,std::atoi(a.c_str()+14)); else if(a.compare(0,14,"--health-rise=")==0) health_rise=std::max(1,std::atoi(a.c_str()+14));
+        else if(a.compare(0,10,"--backend=")==0) backend_specs.push_back(a.substr(10));
+        else if(a.compare(0,7,"--peer=")==0){ std::string ip; uint16_t port; if(!parse_addr(a.substr(7),ip,port)){std::cerr<<"[LB] bad peer "<<a.substr(7)<<"\n";return 1;}
+            sockaddr_in p{}; p.sin_family=AF_INET; p.sin_port=htons(port); inet_pton(AF_INET,ip.c_str(),&p.sin_addr); peers.push_back(p); }
+        else if(a.compare(0,15,"--cluster-port=")==0) cluster_port=std::max(0,std::atoi(a.c_str()+15)); else if(a.compare(0,18,"--gossip-interval=")==0) gossip_interval_s=std::max(0.001,std::atof(a.c_str()+18));
+        else if(a.compare(0,15,"--max-backends=")==0) max_backends=size_t(std::max(0,std::atoi(a.c_str()+15))); else if(a.compare(0,16,"--drain-timeout=")==0) drain_timeout_s=std::max(0.0,std::atof(a.c_str()+16));
+        else if(a.compare(0,8,"--trace=")==0) tracer.set_capacity(size_t(std::max(0,std::atoi(a.c_str()+8))));
+        else if(a.compare(0,12,"--cache-ttl=")==0) cache.ttl_s=std::max(0.0,std::atof(a.c_str()+12)); else if(a.compare(0,11,"--no-cache=")==0) cache.no_cache(a.substr(11));
+        else if(a.compare(0,16,"--cache-entries=")==0) cache.max_entries=size_t(std::max(0,std::atoi(a.c_str()+16))); else if(a.compare(0,14,"--cache-bytes=")==0) cache.max_bytes=size_t(std::max(0ll,std::atoll(a.c_str()+14)));
+        else if(a.compare(0,10,"--nodelay=")==0) tuning.nodelay=std::atoi(a.c_str()+10)!=0; else if(a=="--quickack") tuning.quickack=true;
+        else if(a.compare(0,11,"--fastopen=")==0) tuning.fastopen=std::max(0,std::atoi(a.c_str()+11)); else if(a.compare(0,12,"--busy-poll=")==0) tuning.busy_poll_us=std::max(0,std::atoi(a.c_str()+12));
+        else if(a.compare(0,9,"--sndbuf=")==0) tuning.sndbuf=std::max(0,std::atoi(a.c_str()+9)); else if(a.compare(0,9,"--rcvbuf=")==0) tuning.rcvbuf=std::max(0,std::atoi(a.c_str()+9));
+        else if(a.compare(0,7,"--role=")==0){ if(!roles().define(a.substr(7))){std::cerr<<"[LB] bad role "<<a.substr(7)<<"\n";return 1;} }
+        else {std::cerr<<"usage: "<<argv[0]<<" [--config=FILE] [--listen=IP:PORT] [--backend=ROLE@IP:PORT[/W]].. [--role=NAME:M=m,V=v,P=p,other=o].. [--engine=threads|epoll|uring|coro] [--workers=N] [--reactors=N] [--pool=N] [--pool-idle=SEC] [--pipeline=D] [--keepalive[=N]] [--policy=serpt|jsq|p2c|wrr|late] [--weights=W,..] [--adaptive=ALPHA] [--index-min=N] [--metrics-port=PORT] [--listeners=N] [--backlog=B] [--pin] [--cpus=CLASS:LIST].. [--reply-len=N] [--health-interval=SEC] [--health-timeout=SEC] [--health-fall=N] [--health-rise=N] [--connect-timeout=SEC] [--io-timeout=SEC] [--max-wait=SEC] [--max-active=N] [--max-inflight=N] [--shed=rst|reply] [--queue=srpt|fifo] [--queue-aging=A] [--deadline=T=SEC].. [--peer=IP:PORT].. [--cluster-port=PORT] [--gossip-interval=SEC] [--max-backends=N] [--drain-timeout=SEC] [--trace=N] [--cache-ttl=SEC] [--no-cache=TYPES] [--cache-entries=N] [--cache-bytes=BYTES] [--nodelay=0|1] [--quickack] [--fastopen=QLEN] [--busy-poll=USEC] [--sndbuf=BYTES] [--rcvbuf=BYTES]\n";return 1;} }
+    if(backend_specs.empty()) backend_specs.assign(std::begin(DEFAULT_BACKENDS),std::end(DEFAULT_BACKENDS));
+    backends.reserve(std::max(backend_specs.size(),max_backends));
+    for(const std::string& b:backend_specs) if(!add_backend(b)) return 1;
+    while(backends.size()<max_backends){ backends.emplace_back(VIDEO,"",0); backends.back().state=B_VACANT; }
+    sched.model.reset();
+    if(nlisteners<=0) nlisteners=engine=="threads"?1:reactors;
+    if(nworkers>0&&nworkers<nlisteners) nworkers=nlisteners;     // every acceptor needs a deque of its own
+    if((engine!="threads"&&engine!="epoll"&&engine!="uring"&&engine!="coro")||reactors<1||pool<1||backlog<1){std::cerr<<"[LB] bad engine options\n";return 1;}
+    if(engine=="uring"&&keepalive){ std::cerr<<"[LB] uring engine serves one request per connection, --keepalive ignored\n"; keepalive=0; }
+    if(policy=="late"&&engine!="epoll") std::cerr<<"[LB] late binding needs --engine=epoll; "<<engine<<" binds on arrival (serpt)\n";
+    if(pin) for(ThreadClass c:{TC_REACTOR,TC_ACCEPTOR}) if(class_cpus[c].empty()) parse_cpus("all",class_cpus[c]);
+    for(const std::vector<int>& c:class_cpus) placing|=!c.empty();
+    if(cache.on()&&reply_len>cache.max_bytes){ std::cerr<<"[LB] --reply-len is over --cache-bytes, reply cache off\n"; cache.ttl_s=0; }
+    // epoll pools are per reactor; split the per-backend budget between them
+    pool_max = pool; if(engine!="threads"){ reactor_pool_max=(pool+reactors-1)/reactors; pool_max=reactor_pool_max*reactors; }
+    sched.init(backends.size());
+    for(size_t i=0;i<backends.size();++i){ backends[i].pool_max=pool_max; sched.s[i].role=backends[i].role; sched.s[i].slots=pool_max; sched.s[i].weight=backends[i].weight; }
+    for(size_t i=0,p=0;p<weights.size()&&i<backends.size();++i){ sched.s[i].weight=std::max(1,std::atoi(weights.c_str()+p)); p=weights.find(',',p); if(p==std::string::npos) break; ++p; }
+    sched.build_wrr(); sched.build_index(index_min,roles().names.size()); sched.count_total=max_inflight>0;
+    std::vector<std::string> names;
+    for(size_t i=0;i<backends.size();++i){ bool vacant=backends[i].state==B_VACANT; names.push_back(vacant?"":backend_name(backends[i])); if(vacant) sched.set_retired(i,true,0); }
+    metrics.nodes=numa_nodes(); metrics.init(names);
+    // before any thread starts, so that only control_loop takes these
+    sigset_t ctl; sigemptyset(&ctl); sigaddset(&ctl,SIGHUP); sigaddset(&ctl,SIGUSR2); pthread_sigmask(SIG_BLOCK,&ctl,nullptr);
+    struct sigaction wake{}; wake.sa_handler=on_wake; sigaction(SIGRTMIN,&wake,nullptr);
+    std::thread(control_loop,ctl).detach();
+    if(metrics_port>0) std::thread(metrics_server,metrics_port).detach();
+    if(health_interval_s>0) std::thread(health_checker).detach();
+    if(!peers.empty()&&!cluster_start()) return 1;
+    bool nonblock=engine=="epoll"||engine=="coro";
+    if(const char* fds=getenv("LB_LISTEN_FDS")){       // started by an upgrade: the old process's sockets
+        for(const char* p=fds;*p;){ int fd=std::atoi(p); fcntl(fd,F_SETFD,FD_CLOEXEC); tune_listener(fd); fcntl(fd,F_SETFL,nonblock?fcntl(fd,F_GETFL)|O_NONBLOCK:fcntl(fd,F_GETFL)&~O_NONBLOCK); listen_fds.push_back(fd);
+            p=std::strchr(p,','); if(!p) break; ++p; }
+        unsetenv("LB_LISTEN_FDS");
+    } else for(int i=0;i<nlisteners;++i){ int fd=open_listener(listen_addr,backlog,nonblock); if(fd<0) return 1; listen_fds.push_back(fd); }
+    std::vector<int> listeners=listen_fds;
+    if(const char* r=getenv("LB_READY_FD")){ int fd=std::atoi(r); if(write(fd,"1",1)!=1) perror("upgrade"); close(fd); unsetenv("LB_READY_FD"); }
+    if(policy=="serpt") return serve<SerptPolicy>(engine,reactors,listeners);
+    if(policy=="jsq") return serve<JsqPolicy>(engine,reactors,listeners);
+    if(policy=="p2c") return serve<P2cPolicy>(engine,reactors,listeners);
+    if(policy=="wrr") return serve<WrrPolicy>(engine,reactors,listeners);
+    if(policy=="late") return serve<LatePolicy>(engine,reactors,listeners);
+    std::cerr<<"[LB] unknown policy "<<policy<<"\n"; return 1;
 }
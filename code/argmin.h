@@ -0,0 +1,145 @@
+/*
+ * argmin.h – SERPT scan kernel over the scheduler's structure‑of‑arrays state
+ *
+ * argmin_finish(vf, role, n, now, cost, nroles) returns the i minimising
+ * max(vf[i], now) + cost[role[i]], first one on ties, together with the vf[i]
+ * it saw (the caller CASes against it).  vf and role are the contiguous hot
+ * arrays from SchedTable; cost is the request's price per role, computed once
+ * per pick.  argmin_scalar is the reference; the AVX2 kernel (picked at run
+ * time with __builtin_cpu_supports) and the NEON kernel do 8 and 2 lanes per
+ * step with the same tie‑breaking.  vf is plain memory: the caller scans a
+ * snapshot it took with relaxed atomic loads, and a value gone stale since
+ * only makes its CAS fail and rescan.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LB_ARGMIN_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define LB_ARGMIN_NEON 1
+#endif
+
+// Fixed‑size array on its own cache lines, for hot per‑backend fields.
+template <class T> struct AlignedArray {
+    T* p = nullptr; size_t n = 0;
+    AlignedArray() {}
+    AlignedArray(const AlignedArray&) = delete;
+    AlignedArray& operator=(const AlignedArray&) = delete;
+    ~AlignedArray() { reset(0); }
+    void reset(size_t count) {
+        for (size_t i=0;i<n;++i) p[i].~T();
+        std::free(p); p = nullptr; n = 0;
+        if (!count) return;
+        p = static_cast<T*>(std::aligned_alloc(64, (count*sizeof(T) + 63) / 64 * 64));
+        if (!p) throw std::bad_alloc();
+        for (size_t i=0;i<count;++i) new (&p[i]) T();
+        n = count;
+    }
+    T& operator[](size_t i) { return p[i]; }
+    const T& operator[](size_t i) const { return p[i]; }
+};
+
+static inline size_t argmin_scalar(const int64_t* vf, const uint8_t* role, size_t n, int64_t now, const int64_t* cost, int64_t& seen) {
+    int64_t best = INT64_MAX; size_t idx = 0; seen = 0;
+    for (size_t i=0;i<n;++i) {
+        int64_t f = vf[i], v = (f<now?now:f) + cost[role[i]];
+        if (v<best){best=v; idx=i; seen=f;}
+    }
+    return idx;
+}
+
+// Folds per‑lane winners and the scalar tail [from, n) into one answer.
+static inline size_t argmin_reduce(const int64_t* bv, const int64_t* bf, const int64_t* bi, int lanes,
+                                   const int64_t* vf, const uint8_t* role, size_t from, size_t n, int64_t now, const int64_t* cost, int64_t& seen) {
+    int64_t best = INT64_MAX; size_t idx = 0; seen = 0;
+    for (int k=0;k<lanes;++k) if (bv[k]<best || (bv[k]==best && size_t(bi[k])<idx)) { best=bv[k]; idx=size_t(bi[k]); seen=bf[k]; }
+    for (size_t i=from;i<n;++i) {
+        int64_t f = vf[i], v = (f<now?now:f) + cost[role[i]];
+        if (v<best){best=v; idx=i; seen=f;}
+    }
+    return idx;
+}
+
+#if LB_ARGMIN_AVX2
+// Roles 0..3 are looked up in a register (permutevar8x32 on 32‑bit halves);
+// more roles fall back to a gather, which is slow enough to lose to scalar.
+template <bool SMALL> __attribute__((target("avx2"), always_inline))
+static inline __m256i avx2_cost(const uint8_t* role, __m256i table, const int64_t* cost) {
+    int32_t r4; std::memcpy(&r4, role, 4);
+    __m128i r32 = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(r4));
+    if (!SMALL) return _mm256_i32gather_epi64(reinterpret_cast<const long long*>(cost), r32, 8);
+    __m256i t = _mm256_slli_epi64(_mm256_cvtepu32_epi64(r32), 1);
+    return _mm256_permutevar8x32_epi32(table, _mm256_or_si256(t, _mm256_slli_epi64(_mm256_add_epi64(t, _mm256_set1_epi64x(1)), 32)));
+}
+
+// One 4‑lane step: folds vf[i..i+3] into the running (best, bvf, bidx) lanes.
+template <bool SMALL> __attribute__((target("avx2"), always_inline))
+static inline void avx2_step(const int64_t* vf, const uint8_t* role, __m256i vnow, __m256i table, const int64_t* cost,
+                             __m256i idx, __m256i& best, __m256i& bvf, __m256i& bidx) {
+    __m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(vf));
+    __m256i m = _mm256_blendv_epi8(f, vnow, _mm256_cmpgt_epi64(vnow, f));      // no 64‑bit max before AVX‑512
+    __m256i v = _mm256_add_epi64(m, avx2_cost<SMALL>(role, table, cost)), lt = _mm256_cmpgt_epi64(best, v);
+    best = _mm256_blendv_epi8(best, v, lt); bvf = _mm256_blendv_epi8(bvf, f, lt); bidx = _mm256_blendv_epi8(bidx, idx, lt);
+}
+
+template <bool SMALL> __attribute__((target("avx2")))
+static size_t argmin_avx2(const int64_t* vf, const uint8_t* role, size_t n, int64_t now, const int64_t* cost, int64_t& seen) {
+    const __m256i vnow = _mm256_set1_epi64x(now), four = _mm256_set1_epi64x(4), eight = _mm256_set1_epi64x(8);
+    const __m256i table = SMALL ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cost)) : _mm256_setzero_si256();
+    // two independent accumulator sets, lanes i..i+3 and i+4..i+7, to hide compare/blend latency
+    __m256i best0 = _mm256_set1_epi64x(INT64_MAX), best1 = best0, bvf0 = _mm256_setzero_si256(), bvf1 = bvf0, bidx0 = bvf0, bidx1 = bvf0;
+    __m256i idx = _mm256_setr_epi64x(0, 1, 2, 3);
+    size_t i = 0;
+    for (; i+8<=n; i+=8, idx = _mm256_add_epi64(idx, eight)) {
+        avx2_step<SMALL>(vf + i, role + i, vnow, table, cost, idx, best0, bvf0, bidx0);
+        avx2_step<SMALL>(vf + i + 4, role + i + 4, vnow, table, cost, _mm256_add_epi64(idx, four), best1, bvf1, bidx1);
+    }
+    alignas(32) int64_t bv[8], bf[8], bi[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bv), best0); _mm256_store_si256(reinterpret_cast<__m256i*>(bv + 4), best1);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bf), bvf0); _mm256_store_si256(reinterpret_cast<__m256i*>(bf + 4), bvf1);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bi), bidx0); _mm256_store_si256(reinterpret_cast<__m256i*>(bi + 4), bidx1);
+    return argmin_reduce(bv, bf, bi, i ? 8 : 0, vf, role, i, n, now, cost, seen);
+}
+#endif
+
+#if LB_ARGMIN_NEON
+static size_t argmin_neon(const int64_t* vf, const uint8_t* role, size_t n, int64_t now, const int64_t* cost, int64_t& seen) {
+    const int64x2_t vnow = vdupq_n_s64(now), two = vdupq_n_s64(2);
+    int64x2_t best = vdupq_n_s64(INT64_MAX), bvf = vdupq_n_s64(0), bidx = vdupq_n_s64(0), idx = vcombine_s64(vcreate_s64(0), vcreate_s64(1));
+    size_t i = 0;
+    for (; i+2<=n; i+=2) {
+        int64x2_t f = vld1q_s64(vf + i);
+        int64x2_t m = vbslq_s64(vcgtq_s64(vnow, f), vnow, f);
+        int64x2_t c = vcombine_s64(vcreate_s64(uint64_t(cost[role[i]])), vcreate_s64(uint64_t(cost[role[i+1]])));
+        int64x2_t v = vaddq_s64(m, c); uint64x2_t lt = vcgtq_s64(best, v);
+        best = vbslq_s64(lt, v, best); bvf = vbslq_s64(lt, f, bvf); bidx = vbslq_s64(lt, idx, bidx);
+        idx = vaddq_s64(idx, two);
+    }
+    int64_t bv[2], bf[2], bi[2];
+    vst1q_s64(bv, best); vst1q_s64(bf, bvf); vst1q_s64(bi, bidx);
+    return argmin_reduce(bv, bf, bi, i ? 2 : 0, vf, role, i, n, now, cost, seen);
+}
+#endif
+
+// nroles: one past the highest role id present; cost must be readable up to max(nroles, 4).
+// Below ARGMIN_SIMD_MIN backends the scalar loop wins: there is barely one vector step plus the reduction.
+static const size_t ARGMIN_SIMD_MIN = 16;
+static inline size_t argmin_finish(const int64_t* vf, const uint8_t* role, size_t n, int64_t now, const int64_t* cost, size_t nroles, int64_t& seen) {
+    if (n < ARGMIN_SIMD_MIN) return argmin_scalar(vf, role, n, now, cost, seen);
+#if LB_ARGMIN_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) return nroles <= 4 ? argmin_avx2<true>(vf, role, n, now, cost, seen) : argmin_avx2<false>(vf, role, n, now, cost, seen);
+#elif LB_ARGMIN_NEON
+    (void)nroles; return argmin_neon(vf, role, n, now, cost, seen);
+#endif
+    (void)nroles;
+    return argmin_scalar(vf, role, n, now, cost, seen);
+}
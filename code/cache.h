@@ -0,0 +1,108 @@
+/*
+ * cache.h – LB‑side reply cache for (type, base) requests
+ *
+ * A request is its two bytes and a server's reply depends on nothing else,
+ * so identical requests can be answered from memory.  The key space is
+ * small enough for a flat table, one entry per type byte and base digit, so
+ * a lookup is an index and no hashing.  An entry is fresh for --cache-ttl
+ * seconds after it was filled; --cache-entries and --cache-bytes bound what
+ * is held, and a fill past either evicts the entries that expire first
+ * (with one TTL for all, the oldest).  Types in --no-cache never get here.
+ *
+ * One mutex guards the table: a hit is an index and a copy of --reply-len
+ * bytes, and a miss costs a backend round trip anyway.
+ *
+ * Misses for a key already being fetched are coalesced onto that fetch.
+ * The threads engine does so across all workers with claim / finish /
+ * wait: the first miss fills the entry, later ones block until it finishes
+ * and take its reply, or go to a backend themselves if it failed.  Reactor
+ * engines must not block, so each coalesces within its reactor, keeping its
+ * own table of fetches in flight and using get / put here.
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// What the cache does for one request.  FILL: its reply fills the entry; FOLLOW: waits for a FILL.
+enum CacheClaim : uint8_t { CACHE_NONE, CACHE_HIT, CACHE_FILL, CACHE_FOLLOW };
+
+struct ReplyCache {
+    using Clock = std::chrono::steady_clock;
+    static const size_t KEYS = 256 * 9;             // type byte × base 1..9
+
+    double ttl_s = 0;                               // 0 = off
+    size_t max_entries = 1024, max_bytes = size_t(1) << 20;
+    bool skip[256] = {};                            // --no-cache types
+
+    struct Entry {
+        std::string reply; Clock::time_point expires;
+        bool held = false, filling = false;         // filling: a threads‑engine claim is out
+        uint32_t fills = 0;                         // finished claims, for waiters to see theirs end
+    };
+    Entry e[KEYS];
+    std::mutex mtx; std::condition_variable filled;
+    size_t entries = 0, bytes = 0;                  // mtx
+
+    static size_t key(char type, int base) { return size_t(uint8_t(type)) * 9 + size_t(base - 1); }
+    bool on() const { return ttl_s > 0; }
+    bool wants(char type) const { return ttl_s > 0 && !skip[uint8_t(type)]; }
+    // Parses --no-cache: type letters, optionally comma separated.
+    void no_cache(const std::string& types) { for (char t : types) if (t != ',') skip[uint8_t(t)] = true; }
+
+    // A fresh reply for k copied into out.
+    bool get(size_t k, std::string& out) {
+        std::lock_guard<std::mutex> g(mtx);
+        if (!fresh(e[k])) return false;
+        out.assign(e[k].reply); return true;
+    }
+    void put(size_t k, const char* p, size_t n) { std::lock_guard<std::mutex> g(mtx); store(k, p, n); }
+
+    // HIT: out holds the reply.  FILL: the caller fetches it and must finish(k).
+    // FOLLOW: another fill is out; the caller must wait(k, ticket).  NONE: a
+    // plain miss, when the caller may not fill (see handle_client).
+    CacheClaim claim(size_t k, std::string& out, uint32_t& ticket, bool may_fill) {
+        std::lock_guard<std::mutex> g(mtx);
+        Entry& x = e[k];
+        if (fresh(x)) { out.assign(x.reply); return CACHE_HIT; }
+        if (x.filling) { ticket = x.fills; return CACHE_FOLLOW; }
+        if (!may_fill) return CACHE_NONE;
+        x.filling = true; return CACHE_FILL;
+    }
+    void finish(size_t k, const std::string& reply, bool ok) {
+        { std::lock_guard<std::mutex> g(mtx);
+          if (ok) store(k, reply.data(), reply.size());
+          e[k].filling = false; ++e[k].fills; }
+        filled.notify_all();
+    }
+    // The reply of the fill `ticket` waited for, within wait_ms (-1: no limit);
+    // false if that fill failed or did not finish in time.
+    bool wait(size_t k, uint32_t ticket, std::string& out, int wait_ms) {
+        std::unique_lock<std::mutex> g(mtx);
+        auto done = [&] { return e[k].fills != ticket; };
+        if (wait_ms < 0) filled.wait(g, done);
+        else if (!filled.wait_for(g, std::chrono::milliseconds(wait_ms), done)) return false;
+        if (!fresh(e[k])) return false;
+        out.assign(e[k].reply); return true;
+    }
+
+  private:
+    bool fresh(const Entry& x) const { return x.held && Clock::now() < x.expires; }
+    void drop(Entry& x) { if (!x.held) return; x.held = false; --entries; bytes -= x.reply.size(); std::string().swap(x.reply); }
+    // Under mtx.  Makes room by evicting what expires first; a reply over --cache-bytes is not kept.
+    void store(size_t k, const char* p, size_t n) {
+        Entry& x = e[k]; drop(x);
+        if (n > max_bytes || !max_entries) return;
+        while (entries && (entries >= max_entries || bytes + n > max_bytes)) {
+            Entry* first = nullptr;
+            for (Entry& y : e) if (y.held && (!first || y.expires < first->expires)) first = &y;
+            drop(*first);
+        }
+        x.reply.assign(p, n); x.held = true; ++entries; bytes += n;
+        x.expires = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(ttl_s));
+    }
+};
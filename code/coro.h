@@ -0,0 +1,87 @@
+/*
+ * coro.h – C++20 coroutine plumbing for the LB's coro engine
+ *
+ * Co<T> is a lazily started coroutine that its caller co_awaits; when it
+ * returns it resumes the caller by symmetric transfer, so chains of helpers
+ * use no stack.  A Spawn coroutine is a detached top‑level one (one per client
+ * connection) that frees itself when it returns.  Frames come from FramePool,
+ * a per‑thread free list per 64‑byte size class: a reactor thread reuses its
+ * own frames, so in steady state a request allocates nothing.  LB_HAVE_CORO is
+ * 0 without compiler support (e.g. -std=c++17); the engine then refuses to
+ * start and the LB falls back to epoll.
+ */
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define LB_HAVE_CORO 1
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <utility>
+
+struct FramePool {
+    static const size_t CLASS = 64, CLASSES = 64;      // frames up to 4 KiB are pooled
+    struct Node { Node* next; };
+    Node* free_list[CLASSES] = {};
+
+    static FramePool& local() { static thread_local FramePool p; return p; }
+    void* alloc(size_t n) {
+        size_t c = (n + CLASS - 1) / CLASS;
+        if (c >= CLASSES) return ::operator new(n);
+        if (Node* f = free_list[c]) { free_list[c] = f->next; return f; }
+        return ::operator new(c * CLASS);
+    }
+    void release(void* p, size_t n) {
+        size_t c = (n + CLASS - 1) / CLASS;
+        if (c >= CLASSES) { ::operator delete(p); return; }
+        Node* f = static_cast<Node*>(p); f->next = free_list[c]; free_list[c] = f;
+    }
+    ~FramePool() { for (Node*& h : free_list) while (h) { Node* n = h->next; ::operator delete(h); h = n; } }
+};
+
+struct FramePromise {
+    static void* operator new(size_t n) { return FramePool::local().alloc(n); }
+    static void operator delete(void* p, size_t n) { FramePool::local().release(p, n); }
+    void unhandled_exception() { std::terminate(); }
+};
+
+template <class T> struct Co {
+    struct promise_type : FramePromise {
+        T value{}; std::coroutine_handle<> caller;
+        Co get_return_object() { return Co(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        struct Final {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept { return h.promise().caller; }
+            void await_resume() noexcept {}
+        };
+        Final final_suspend() noexcept { return {}; }
+        void return_value(T v) { value = std::move(v); }
+    };
+    std::coroutine_handle<promise_type> h;
+
+    explicit Co(std::coroutine_handle<promise_type> h_) : h(h_) {}
+    Co(Co&& o) noexcept : h(std::exchange(o.h, {})) {}
+    Co(const Co&) = delete;
+    Co& operator=(const Co&) = delete;
+    ~Co() { if (h) h.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept { h.promise().caller = c; return h; }
+    T await_resume() { return std::move(h.promise().value); }
+};
+
+struct Spawn {
+    struct promise_type : FramePromise {
+        Spawn get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+    };
+};
+
+#else
+#define LB_HAVE_CORO 0
+#endif
@@ -0,0 +1,189 @@
+/*
+ * loadgen.cpp – replay client scripts against SmartLB and report latency
+ *
+ *   ./loadgen [--lb=IP:PORT] [--repeat=N] [--fast] [--speed=X] [--keepalive [--reply-len=N]] FILE...
+ *   ./loadgen --serve=VIDEO@IP:PORT [--serve=MUSIC@IP:PORT ...] [--role=SPEC ...] [--scale=S] [FILE...]
+ *
+ * A FILE (see workload.h) is a client script, sent one request per connection
+ * like client.py, or a timed trace, replayed open loop at the recorded offsets
+ * (divided by --speed; --fast sends them all at once).
+ * --repeat runs N copies of every file concurrently.
+ * --keepalive sends each file's requests on one connection instead (for an
+ * LB run with --keepalive), at the same offsets, then half‑closes it; every
+ * reply must come back whole (--reply-len bytes, default 2) and in request
+ * order, starting with its request's two bytes as the stubs echo them.  A
+ * request's latency runs from its send to the end of its reply.
+ *
+ * --serve starts stub backends that answer like server.py: read 2‑byte
+ * requests on a persistent connection, sleep multiplier()*base*scale seconds
+ * and echo the request; --role defines more roles as the LB's --role does.
+ * With no FILE the stubs just keep serving.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sched.h"
+#include "workload.h"
+
+using Steady = std::chrono::steady_clock;
+
+struct Sample { char type; double ms; };
+
+static sockaddr_in lb_addr;
+static std::mutex samples_mtx;
+static std::vector<Sample> samples;
+static long failures = 0;
+
+static bool parse_addr(const std::string& s, sockaddr_in& a) {
+    size_t colon = s.rfind(':'); if (colon == std::string::npos) return false;
+    memset(&a, 0, sizeof(a)); a.sin_family = AF_INET; a.sin_port = htons(std::atoi(s.c_str()+colon+1));
+    return inet_pton(AF_INET, s.substr(0, colon).c_str(), &a.sin_addr) == 1;
+}
+
+// One request on its own connection, as client.py does it.
+static void send_one(const char* req) {
+    Steady::time_point t0 = Steady::now();
+    bool ok = false;
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s >= 0 && connect(s, (sockaddr*)&lb_addr, sizeof(lb_addr)) == 0 && send(s, req, 2, MSG_NOSIGNAL) == 2) {
+        char buf[1024], first = 0; size_t total = 0; ssize_t n;
+        while ((n = recv(s, buf, sizeof(buf), 0)) > 0) { if (!total) first = buf[0]; total += n; }
+        ok = n == 0 && total && first == req[0];
+    }
+    if (s >= 0) close(s);
+    double ms = std::chrono::duration<double, std::milli>(Steady::now() - t0).count();
+    std::lock_guard<std::mutex> g(samples_mtx);
+    if (ok) samples.push_back(Sample{req[0], ms}); else ++failures;
+}
+
+// A script's requests on one connection: a sender thread writes them at their
+// offsets and half‑closes, this thread reads the replies and matches them in order.
+static size_t reply_len = 2;
+static void run_keepalive(const Script& sc, Steady::time_point start, double speed, bool fast) {
+    std::vector<Steady::time_point> sent(sc.reqs.size()); std::mutex sent_mtx;
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0 || connect(s, (sockaddr*)&lb_addr, sizeof(lb_addr)) != 0) {
+        if (s >= 0) close(s);
+        std::lock_guard<std::mutex> g(samples_mtx); failures += long(sc.reqs.size()); return;
+    }
+    std::thread sender([&]{
+        for (size_t k = 0; k < sc.reqs.size(); ++k) {
+            if (sc.timed && !fast) std::this_thread::sleep_until(start + std::chrono::duration_cast<Steady::duration>(std::chrono::duration<double, std::milli>(sc.reqs[k].at_ms / speed)));
+            { std::lock_guard<std::mutex> g(sent_mtx); sent[k] = Steady::now(); }
+            if (send(s, sc.reqs[k].req, 2, MSG_NOSIGNAL) != 2) break;
+        }
+        shutdown(s, SHUT_WR);
+    });
+    std::vector<char> reply(reply_len); std::vector<Sample> got; size_t k = 0, have = 0; ssize_t n = 1;
+    for (; k < sc.reqs.size(); ++k, have = 0) {
+        while (have < reply_len && (n = recv(s, reply.data() + have, reply_len - have, 0)) > 0) have += size_t(n);
+        if (have < reply_len || memcmp(reply.data(), sc.reqs[k].req, std::min<size_t>(2, reply_len)) != 0) break;   // short, or out of order
+        Steady::time_point sent_at; { std::lock_guard<std::mutex> g(sent_mtx); sent_at = sent[k]; }
+        got.push_back(Sample{sc.reqs[k].req[0], std::chrono::duration<double, std::milli>(Steady::now() - sent_at).count()});
+    }
+    bool clean = k == sc.reqs.size() && recv(s, reply.data(), reply_len, 0) == 0;   // nothing after the last reply
+    shutdown(s, SHUT_RDWR); sender.join(); close(s);
+    std::lock_guard<std::mutex> g(samples_mtx);
+    samples.insert(samples.end(), got.begin(), got.end());
+    failures += long(sc.reqs.size() - got.size()) + (clean || k < sc.reqs.size() ? 0 : 1);
+}
+
+static void run_script(const Script& sc, Steady::time_point start, double speed, bool fast) {
+    if (!sc.timed) { for (const Req& q : sc.reqs) send_one(q.req); return; }
+    std::vector<std::thread> ts;
+    for (const Req& q : sc.reqs) {
+        if (!fast) std::this_thread::sleep_until(start + std::chrono::duration_cast<Steady::duration>(std::chrono::duration<double, std::milli>(q.at_ms / speed)));
+        ts.emplace_back(send_one, q.req);
+    }
+    for (auto& t : ts) t.join();
+}
+
+/* ───────────── stub backend ───────────── */
+static double stub_scale = 1.0;
+
+static void stub_conn(int fd, Role role) {
+    char req[2];
+    while (true) {
+        size_t got = 0;
+        while (got < 2) { ssize_t n = recv(fd, req + got, 2 - got, 0); if (n <= 0) { close(fd); return; } got += n; }
+        std::this_thread::sleep_for(std::chrono::duration<double>(multiplier(req[0], role) * (req[1]-'0') * stub_scale));
+        if (send(fd, req, 2, MSG_NOSIGNAL) != 2) { close(fd); return; }
+    }
+}
+
+static bool start_stub(const std::string& spec) {
+    size_t at = spec.find('@'); if (at == std::string::npos) return false;
+    std::string role_s = spec.substr(0, at); int r = roles().find(role_s); if (r < 0) return false;
+    Role role = Role(r);
+    sockaddr_in a; if (!parse_addr(spec.substr(at+1), a)) return false;
+    int s = socket(AF_INET, SOCK_STREAM, 0); if (s < 0) return false;
+    int opt = 1; setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)); setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    if (bind(s, (sockaddr*)&a, sizeof(a)) < 0 || listen(s, 128) < 0) { perror(("stub " + spec).c_str()); close(s); return false; }
+    std::thread([s, role]{ while (true) { int c = accept(s, nullptr, nullptr); if (c >= 0) std::thread(stub_conn, c, role).detach(); } }).detach();
+    std::cout << "[loadgen] stub " << role_s << " backend on " << spec.substr(at+1) << std::endl;
+    return true;
+}
+
+/* ───────────── report ───────────── */
+static double pct(const std::vector<double>& v, double p) {
+    if (v.empty()) return 0;
+    size_t i = size_t(p * (v.size() - 1) + 0.5); return v[std::min(i, v.size() - 1)];
+}
+
+static void report(double secs) {
+    std::map<char, std::vector<double>> by_type; std::vector<double> all;
+    for (const Sample& s : samples) { by_type[s.type].push_back(s.ms); all.push_back(s.ms); }
+    std::printf("completed %zu requests (%ld failed) in %.3f s, %.1f req/s\n", samples.size(), failures, secs, samples.size() / secs);
+    std::printf("%-6s %8s %10s %10s %10s %10s\n", "type", "count", "p50 ms", "p99 ms", "p999 ms", "max ms");
+    auto row = [](const std::string& name, std::vector<double>& v) {
+        std::sort(v.begin(), v.end());
+        std::printf("%-6s %8zu %10.1f %10.1f %10.1f %10.1f\n", name.c_str(), v.size(), pct(v, .5), pct(v, .99), pct(v, .999), v.empty() ? 0 : v.back());
+    };
+    for (auto& kv : by_type) row(std::string(1, kv.first), kv.second);
+    row("all", all);
+}
+
+int main(int argc, char** argv) {
+    std::string lb = "127.0.0.1:80"; int repeat = 1; bool fast = false, keepalive = false; double speed = 1; std::vector<std::string> files, stubs;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a.compare(0, 5, "--lb=") == 0) lb = a.substr(5);
+        else if (a.compare(0, 9, "--repeat=") == 0) repeat = std::max(1, std::atoi(a.c_str()+9));
+        else if (a == "--fast") fast = true;
+        else if (a.compare(0, 8, "--speed=") == 0) speed = std::atof(a.c_str()+8);
+        else if (a == "--keepalive") keepalive = true;
+        else if (a.compare(0, 12, "--reply-len=") == 0) reply_len = size_t(std::max(1, std::atoi(a.c_str()+12)));
+        else if (a.compare(0, 8, "--serve=") == 0) stubs.push_back(a.substr(8));
+        else if (a.compare(0, 8, "--scale=") == 0) stub_scale = std::atof(a.c_str()+8);
+        else if (a.compare(0, 7, "--role=") == 0) { if (!roles().define(a.substr(7))) { std::cerr << "[loadgen] bad --role " << a << "\n"; return 1; } }
+        else if (a.compare(0, 2, "--") == 0) { std::cerr << "usage: " << argv[0] << " [--lb=IP:PORT] [--repeat=N] [--fast] [--speed=X] [--keepalive] [--reply-len=N] [--serve=ROLE@IP:PORT].. [--role=SPEC].. [--scale=S] FILE...\n"; return 1; }
+        else files.push_back(a);
+    }
+    if (speed <= 0 || !parse_addr(lb, lb_addr)) { std::cerr << "[loadgen] bad --lb or --speed\n"; return 1; }
+    for (const std::string& s : stubs) if (!start_stub(s)) { std::cerr << "[loadgen] bad --serve " << s << "\n"; return 1; }
+    if (files.empty()) { if (stubs.empty()) return 1; while (true) std::this_thread::sleep_for(std::chrono::hours(1)); }
+
+    std::vector<Script> scripts(files.size());
+    for (size_t i = 0; i < files.size(); ++i) if (!load_script(files[i], scripts[i])) return 1;
+    Steady::time_point start = Steady::now();
+    std::vector<std::thread> ts;
+    for (int k = 0; k < repeat; ++k) for (const Script& sc : scripts) ts.emplace_back(keepalive ? run_keepalive : run_script, std::cref(sc), start, speed, fast);
+    for (auto& t : ts) t.join();
+    report(std::chrono::duration<double>(Steady::now() - start).count());
+    return failures ? 2 : 0;
+}
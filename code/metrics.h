@@ -0,0 +1,175 @@
+/*
+ * metrics.h – sharded latency histograms and counters, Prometheus text export
+ *
+ * Recording is a couple of relaxed fetch_adds into the calling thread's shard.
+ * Threads share cache‑line aligned shards round‑robin rather than each owning
+ * one: there is a shard per CPU up to MAX_SHARDS (the thread‑per‑client engine
+ * would otherwise need one per connection), a thread takes the next one on its
+ * first record, and the exporter sums shards when scraped.  On a NUMA machine
+ * the shards are split between nodes and a thread takes the next of its node's,
+ * so counters a placed thread bumps stay in its node's caches.  A shard's
+ * histograms for a backend are allocated when it first records for that
+ * backend, so a backend slot nothing records for costs a pointer and its
+ * counters.  Histograms are HDR style log‑linear: 8 sub‑buckets per power of
+ * two of microseconds, so quantiles are within 12.5% at any magnitude.
+ */
+#pragma once
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Histogram {
+    static const int SUB_BITS = 3, SUB = 1 << SUB_BITS, OCTAVES = 38, BUCKETS = (OCTAVES + 1) * SUB;
+    std::atomic<uint64_t> b[BUCKETS];
+    std::atomic<uint64_t> sum_us{0};
+
+    Histogram() { for (auto& x : b) x.store(0, std::memory_order_relaxed); }
+
+    static int index(uint64_t us) {
+        if (us < uint64_t(SUB)) return int(us);
+        int k = 63 - __builtin_clzll(us);
+        int idx = (k - SUB_BITS + 1) * SUB + int((us >> (k - SUB_BITS)) & (SUB - 1));
+        return idx < BUCKETS ? idx : BUCKETS - 1;
+    }
+    static double lower(int idx) {
+        if (idx < SUB) return idx;
+        int k = idx / SUB + SUB_BITS - 1; return double(uint64_t(SUB + idx % SUB) << (k - SUB_BITS));
+    }
+    void record(uint64_t us) {
+        b[index(us)].fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add(us, std::memory_order_relaxed);
+    }
+};
+
+enum Phase { PH_QUEUE, PH_SERVICE, PH_TOTAL, PHASE_COUNT };
+enum BackendCounter { BC_REQUESTS, BC_FAILURES, BC_CONNECTS, BACKEND_COUNTER_COUNT };
+enum GlobalCounter { GC_ACCEPTS, GC_CLOSES, GC_BAD_REQUESTS, GC_SHED, GC_GOSSIP_SENT, GC_GOSSIP_RECEIVED,
+                    GC_CACHE_HITS, GC_CACHE_MISSES, GC_CACHE_COALESCED, GLOBAL_COUNTER_COUNT };
+
+struct alignas(64) MetricShard {
+    std::unique_ptr<std::atomic<Histogram*>[]> hist;        // [backend] → [type][phase], nullptr until recorded
+    std::unique_ptr<std::atomic<uint64_t>[]> bcount;        // [backend][counter]
+    std::atomic<uint64_t> gcount[GLOBAL_COUNTER_COUNT];
+    size_t backends = 0;
+
+    ~MetricShard() { for (size_t b = 0; b < backends; ++b) delete[] hist[b].load(std::memory_order_relaxed); }
+};
+
+struct Metrics {
+    static const int MAX_SHARDS = 16, TYPES = 4;            // types as in CostModel: M, V, P, other
+    int nshards = 0;
+    std::unique_ptr<MetricShard[]> shards;
+    std::vector<std::string> names;                         // "" for an unused backend slot, which is not exported
+    mutable std::mutex names_mtx;                           // names may change on a reload
+    std::atomic<unsigned> next_shard{0};
+    int nodes = 1;                                          // NUMA nodes, set before init
+
+    static int type_slot(char t) { return t=='M'?0 : t=='V'?1 : t=='P'?2 : 3; }
+
+    void init(const std::vector<std::string>& backend_names) {
+        names = backend_names; size_t n = names.size();
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nshards = int(std::min<long>(MAX_SHARDS, std::max<long>({ cpus, long(nodes), 1 })));
+        shards.reset(new MetricShard[nshards]);
+        for (MetricShard& s : all()) {
+            s.hist.reset(new std::atomic<Histogram*>[n]); s.backends = n;
+            for (size_t b = 0; b < n; ++b) s.hist[b].store(nullptr, std::memory_order_relaxed);
+            s.bcount.reset(new std::atomic<uint64_t>[n * BACKEND_COUNTER_COUNT]);
+            for (size_t i = 0; i < n * BACKEND_COUNTER_COUNT; ++i) s.bcount[i].store(0, std::memory_order_relaxed);
+            for (auto& c : s.gcount) c.store(0, std::memory_order_relaxed);
+        }
+    }
+    struct Span { MetricShard *b, *e; MetricShard* begin() const { return b; } MetricShard* end() const { return e; } };
+    Span all() const { return Span{ shards.get(), shards.get() + nshards }; }
+    MetricShard& shard() {
+        static thread_local int mine = -1;
+        if (mine < 0) {
+            int per = nshards / std::min(std::max(nodes, 1), nshards); unsigned cpu = 0, node = 0;
+            if (per == nshards || syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) node = 0;
+            mine = int(node % unsigned(nshards / per)) * per + int(next_shard.fetch_add(1, std::memory_order_relaxed) % unsigned(per));
+        }
+        return shards[mine];
+    }
+    // This shard's [type][phase] block for a backend; the first recorder allocates it.
+    static Histogram* block(MetricShard& s, size_t backend) {
+        Histogram* h = s.hist[backend].load(std::memory_order_acquire);
+        if (h) return h;
+        Histogram* fresh = new Histogram[TYPES * PHASE_COUNT];
+        if (s.hist[backend].compare_exchange_strong(h, fresh, std::memory_order_acq_rel)) return fresh;
+        delete[] fresh; return h;                           // another thread of this shard won
+    }
+    void rename(size_t backend, const std::string& name) { std::lock_guard<std::mutex> g(names_mtx); names[backend] = name; }
+    std::vector<std::string> names_now() const { std::lock_guard<std::mutex> g(names_mtx); return names; }
+    void count(GlobalCounter c) { shard().gcount[c].fetch_add(1, std::memory_order_relaxed); }
+    uint64_t total(GlobalCounter c) const { uint64_t v = 0; for (const MetricShard& s : all()) v += s.gcount[c].load(std::memory_order_relaxed); return v; }
+    void count(size_t backend, BackendCounter c) { shard().bcount[backend * BACKEND_COUNTER_COUNT + c].fetch_add(1, std::memory_order_relaxed); }
+    void latency(size_t backend, char type, int64_t queue_us, int64_t service_us, int64_t total_us) {
+        Histogram* h = block(shard(), backend) + type_slot(type) * PHASE_COUNT;
+        h[PH_QUEUE].record(queue_us > 0 ? queue_us : 0); h[PH_SERVICE].record(service_us > 0 ? service_us : 0); h[PH_TOTAL].record(total_us > 0 ? total_us : 0);
+    }
+
+    // Prometheus text format: counters, then one summary per (backend, type, phase).
+    std::string render() const {
+        static const char* types[TYPES] = { "M", "V", "P", "other" };
+        static const char* phases[PHASE_COUNT] = { "queue", "service", "total" };
+        static const char* bcnames[BACKEND_COUNTER_COUNT] = { "lb_backend_requests_total", "lb_backend_failures_total", "lb_backend_connects_total" };
+        std::string out; char line[256]; std::vector<std::string> names = names_now();
+        uint64_t g[GLOBAL_COUNTER_COUNT] = {};
+        for (const MetricShard& s : all()) for (int c = 0; c < GLOBAL_COUNTER_COUNT; ++c) g[c] += s.gcount[c].load(std::memory_order_relaxed);
+        std::snprintf(line, sizeof(line), "# TYPE lb_accepts_total counter\nlb_accepts_total %llu\n# TYPE lb_closes_total counter\nlb_closes_total %llu\n",
+                      (unsigned long long)g[GC_ACCEPTS], (unsigned long long)g[GC_CLOSES]);
+        out += line;
+        std::snprintf(line, sizeof(line), "# TYPE lb_bad_requests_total counter\nlb_bad_requests_total %llu\n# TYPE lb_shed_total counter\nlb_shed_total %llu\n",
+                      (unsigned long long)g[GC_BAD_REQUESTS], (unsigned long long)g[GC_SHED]);
+        out += line;
+        std::snprintf(line, sizeof(line), "# TYPE lb_gossip_sent_total counter\nlb_gossip_sent_total %llu\n# TYPE lb_gossip_received_total counter\nlb_gossip_received_total %llu\n",
+                      (unsigned long long)g[GC_GOSSIP_SENT], (unsigned long long)g[GC_GOSSIP_RECEIVED]);
+        out += line;
+        std::snprintf(line, sizeof(line), "# TYPE lb_cache_hits_total counter\nlb_cache_hits_total %llu\n# TYPE lb_cache_misses_total counter\nlb_cache_misses_total %llu\n",
+                      (unsigned long long)g[GC_CACHE_HITS], (unsigned long long)g[GC_CACHE_MISSES]);
+        out += line;
+        std::snprintf(line, sizeof(line), "# TYPE lb_cache_coalesced_total counter\nlb_cache_coalesced_total %llu\n", (unsigned long long)g[GC_CACHE_COALESCED]);
+        out += line;
+        for (int c = 0; c < BACKEND_COUNTER_COUNT; ++c) {
+            out += std::string("# TYPE ") + bcnames[c] + " counter\n";
+            for (size_t b = 0; b < names.size(); ++b) {
+                if (names[b].empty()) continue;
+                uint64_t v = 0; for (const MetricShard& s : all()) v += s.bcount[b * BACKEND_COUNTER_COUNT + c].load(std::memory_order_relaxed);
+                std::snprintf(line, sizeof(line), "%s{backend=\"%s\"} %llu\n", bcnames[c], names[b].c_str(), (unsigned long long)v); out += line;
+            }
+        }
+        out += "# TYPE lb_latency_seconds summary\n";
+        std::vector<uint64_t> merged(Histogram::BUCKETS);
+        for (size_t b = 0; b < names.size(); ++b) for (int t = 0; t < TYPES; ++t) for (int p = 0; p < PHASE_COUNT; ++p) {
+            if (names[b].empty()) continue;
+            size_t at = size_t(t) * PHASE_COUNT + p; uint64_t count = 0, sum = 0;
+            std::fill(merged.begin(), merged.end(), 0);
+            for (const MetricShard& s : all()) {                 // a shard that never recorded for b counts zeros
+                const Histogram* h = s.hist[b].load(std::memory_order_acquire); if (!h) continue;
+                for (int i = 0; i < Histogram::BUCKETS; ++i) merged[i] += h[at].b[i].load(std::memory_order_relaxed);
+                sum += h[at].sum_us.load(std::memory_order_relaxed);
+            }
+            for (uint64_t c : merged) count += c;
+            if (!count) continue;
+            std::string labels = "backend=\"" + names[b] + "\",type=\"" + types[t] + "\",phase=\"" + phases[p] + "\"";
+            for (double q : { 0.5, 0.9, 0.99, 0.999 }) {
+                uint64_t rank = uint64_t(q * double(count - 1)), seen = 0; int i = 0;
+                while (i < Histogram::BUCKETS - 1 && (seen += merged[i]) <= rank) ++i;
+                double us = (Histogram::lower(i) + Histogram::lower(i + 1)) / 2;
+                std::snprintf(line, sizeof(line), "lb_latency_seconds{%s,quantile=\"%g\"} %.6f\n", labels.c_str(), q, us / 1e6); out += line;
+            }
+            std::snprintf(line, sizeof(line), "lb_latency_seconds_sum{%s} %.6f\nlb_latency_seconds_count{%s} %llu\n", labels.c_str(), double(sum) / 1e6, labels.c_str(), (unsigned long long)count);
+            out += line;
+        }
+        return out;
+    }
+};
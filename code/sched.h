@@ -0,0 +1,527 @@
+/*
+ * sched.h – scheduler state and policies shared by the LB and its benchmarks
+ *
+ * Virtual time is kept in fixed‑point ticks (microseconds since LB start) so a
+ * backend's virtual finish time fits in one atomic word and can be advanced
+ * with compare‑and‑swap instead of under a global mutex.
+ *
+ * A policy is a type with a static pick(SchedTable&, type, base, now); engines
+ * are instantiated per policy so the hot path has no indirect call.
+ *
+ * Roles are entries in a small table of per‑type cost multipliers; VIDEO and
+ * MUSIC are the original server pair and --role= specs add or redefine others.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "argmin.h"
+
+typedef uint8_t Role;
+static const int MAX_ROLES = 16, REQ_TYPES = 4;    // request types: M, V, P, anything else
+enum : Role { VIDEO, MUSIC };                      // built in, as server.py defines them
+
+typedef int64_t vtime_t;
+static const vtime_t VT_PER_SEC = 1000000;
+static const vtime_t VT_DOWN = INT64_MAX / 4;      // an ejected backend's vfinish: behind every live one, with headroom for costs
+static const vtime_t VT_RETIRED = INT64_MAX / 2;   // a removed or vacant slot's: behind even the down ones
+
+static inline int type_slot(char t) { return t=='M'?0 : t=='V'?1 : t=='P'?2 : 3; }
+
+struct RoleTable {
+    std::vector<std::string> names{ "VIDEO", "MUSIC" };
+    int mult[MAX_ROLES][REQ_TYPES] = { { 2, 1, 1, 1 }, { 1, 3, 2, 2 } };
+
+    int find(const std::string& name) const { for (size_t i=0;i<names.size();++i) if (names[i]==name) return int(i); return -1; }
+    // "NAME:M=2,V=1,P=1,other=1"; types left out cost 1.  Redefines NAME if it exists.
+    bool define(const std::string& spec) {
+        size_t colon = spec.find(':'); std::string name = spec.substr(0, colon);
+        if (name.empty()) return false;
+        int r = find(name);
+        if (r < 0) { if (names.size() >= size_t(MAX_ROLES)) return false; r = int(names.size()); names.push_back(name); }
+        int m[REQ_TYPES] = { 1, 1, 1, 1 };
+        for (size_t p = colon; p != std::string::npos && p + 1 < spec.size();) {
+            size_t end = spec.find(',', p + 1), eq = spec.find('=', p + 1);
+            if (eq == std::string::npos || eq > end) return false;
+            std::string t = spec.substr(p + 1, eq - p - 1); int v = std::atoi(spec.c_str() + eq + 1);
+            if (v <= 0 || (t != "M" && t != "V" && t != "P" && t != "other")) return false;
+            m[t == "other" ? 3 : type_slot(t[0])] = v; p = end;
+        }
+        for (int t=0;t<REQ_TYPES;++t) mult[r][t] = m[t];
+        return true;
+    }
+};
+static inline RoleTable& roles() { static RoleTable t; return t; }
+
+static inline int multiplier(char t, Role r) { return roles().mult[r][type_slot(t)]; }
+
+struct alignas(64) SchedSlot {         // per backend; the scan's hot fields live in SchedTable
+    std::atomic<uint32_t> active{0};   // picked, not yet completed
+    Role role = VIDEO;
+    uint32_t slots = 1;                // parallel upstream connections
+    uint32_t weight = 1;               // round‑robin share
+    std::atomic<bool> down{false};     // ejected by health checks
+    std::atomic<bool> retired{false};  // removed by a reload, or a slot no backend has used yet
+};
+
+static inline vtime_t cost_ticks(char type, int base, Role r) { return vtime_t(multiplier(type,r))*base*VT_PER_SEC; }
+
+/* Per‑unit service cost for each (request type, backend role), seeded from
+ * multiplier() and pulled toward observed service times by an EWMA. */
+struct CostModel {
+    static const int TYPES = REQ_TYPES;
+    std::atomic<vtime_t> unit[TYPES][MAX_ROLES];
+    double alpha = 0.125;              // 0 keeps the static table
+
+    CostModel() { reset(); }
+    // Rerun after roles are (re)defined.
+    void reset() {
+        const char names[TYPES] = { 'M', 'V', 'P', '?' };
+        for (int t=0;t<TYPES;++t) for (int r=0;r<MAX_ROLES;++r) unit[t][r].store(cost_ticks(names[t],1,Role(r)), std::memory_order_relaxed);
+    }
+    vtime_t cost(char type, int base, Role r) const { return unit[type_slot(type)][r].load(std::memory_order_relaxed)*base; }
+    // Racing observers may drop a sample; that only slows convergence.
+    void observe(char type, int base, Role r, vtime_t took) {
+        if (alpha<=0 || base<=0) return;
+        std::atomic<vtime_t>& u = unit[type_slot(type)][r];
+        vtime_t cur = u.load(std::memory_order_relaxed);
+        u.store(cur + vtime_t(alpha*double(took/base - cur)), std::memory_order_relaxed);
+    }
+};
+
+/* How requests queued for a backend's connections are ordered.  SRPT, the
+ * default, ranks one by aging·enqueued + its service estimate, capped at its
+ * type's deadline if one is set: the shortest expected job goes first, and a
+ * waiter gains `aging` ticks of rank per tick it waits, so a stream of short
+ * jobs holds a long one back for at most est/aging.  fifo ranks by arrival. */
+struct QueueOrder {
+    bool fifo = false;
+    double aging = 0.1;                // 0: pure SRPT, long jobs may starve
+    vtime_t deadline[REQ_TYPES] = {};  // 0: none
+
+    vtime_t rank(char type, vtime_t est, vtime_t now) const {
+        if (fifo) return now;
+        vtime_t d = deadline[type_slot(type)];
+        return vtime_t(aging*double(now)) + (d && d < est ? d : est);
+    }
+    // "V=2.5": requests of type V are ranked as if they needed at most 2.5 s.
+    bool set_deadline(const std::string& spec) {
+        size_t eq = spec.find('='); if (eq == std::string::npos) return false;
+        std::string t = spec.substr(0, eq); double sec = std::atof(spec.c_str() + eq + 1);
+        if (sec < 0 || (t != "M" && t != "V" && t != "P" && t != "other")) return false;
+        deadline[t == "other" ? 3 : type_slot(t[0])] = vtime_t(sec*VT_PER_SEC); return true;
+    }
+};
+
+/* Waiters on one backend as a binary min‑heap on (rank, arrival); equal ranks
+ * leave in arrival order.  Only grows past its high‑water mark. */
+template <class T> struct WaitQueue {
+    struct Item { vtime_t rank; uint64_t seq; T v; };
+    std::vector<Item> h;
+    uint64_t seq = 0;
+
+    static bool later(const Item& a, const Item& b) { return a.rank != b.rank ? a.rank > b.rank : a.seq > b.seq; }
+    bool empty() const { return h.empty(); }
+    size_t size() const { return h.size(); }
+    T& top() { return h.front().v; }
+    vtime_t top_rank() const { return h.front().rank; }
+    void push(T v, vtime_t rank) { h.push_back(Item{ rank, seq++, std::move(v) }); std::push_heap(h.begin(), h.end(), later); }
+    void pop() { std::pop_heap(h.begin(), h.end(), later); h.pop_back(); }
+    void reserve(size_t n) { h.reserve(n); }
+    void swap(WaitQueue& o) { h.swap(o.h); std::swap(seq, o.seq); }
+    // O(n); for a waiter that gives up.
+    bool erase(const T& v) {
+        for (size_t i = 0; i < h.size(); ++i) if (h[i].v == v) { h[i] = std::move(h.back()); h.pop_back(); std::make_heap(h.begin(), h.end(), later); return true; }
+        return false;
+    }
+};
+
+/* Backends of one role, as a binary min‑heap on vfinish.  Within a role every
+ * backend quotes the same cost, so the one that drains first is the best;
+ * `top` mirrors h[0] so pickers can compare roles without the lock. */
+struct RoleHeap {
+    std::mutex mtx;
+    std::vector<uint32_t> h;
+    std::atomic<uint32_t> top{EMPTY};
+    static constexpr uint32_t EMPTY = UINT32_MAX;   // no backend of this role at the moment
+};
+
+/* SERPT over backends with `slots` parallel connections: vfinish is when the
+ * queued work drains if spread over all slots, so a new request finishes at
+ * max(vfinish,now)+dur but only pushes the backlog by dur/slots.
+ *
+ * The scan's inputs are kept as structure of arrays: vfinish and each
+ * backend's role in contiguous cache‑aligned arrays, and the request's cost
+ * per role in a table built per pick, so argmin_finish() walks 8 backends per
+ * cache line (4 per AVX2 step) instead of one SchedSlot each.
+ *
+ * Below build_index()'s threshold (INDEX_MIN by default, --index-min in
+ * the LB) pick() scans them all lock‑free, with the SIMD kernel from
+ * ARGMIN_SIMD_MIN backends; from there on it keeps a RoleHeap per role and
+ * pick() compares only the role heads, O(roles + log n), taking the winning
+ * role's lock to advance it.  Which side wins depends on the machine:
+ * sched_bench times scalar scan, SIMD scan and index end to end.  simd =
+ * false keeps the scan scalar, for that comparison.
+ *
+ * In a cluster of LBs in front of the same backends, share_moves() makes
+ * every move of vfinish (a pick's charge, a settle or cancel) also add to the
+ * backend's outbox, which the cluster code drains to its peers; merge()
+ * applies a peer's moves here as if this node had made them. */
+struct SchedTable {
+    static const size_t INDEX_MIN = 16;
+    std::unique_ptr<SchedSlot[]> s;
+    size_t n = 0;
+    AlignedArray<std::atomic<vtime_t>> vfinish;
+    AlignedArray<uint8_t> role_of;     // copy of s[i].role, refreshed by build_index
+    std::mutex mtx;                    // pick_locked only
+    std::vector<uint32_t> wrr;         // smooth weighted round‑robin sequence
+    std::atomic<uint64_t> wrr_next{0};
+    CostModel model;
+    QueueOrder order;                  // of requests waiting for a backend's connections
+    std::unique_ptr<RoleHeap[]> heaps; // null: no index, vfinish is CAS'd directly
+    std::unique_ptr<uint32_t[]> heap_pos;
+    std::vector<Role> live_roles;
+    std::atomic<uint32_t> total{0};    // active requests over all backends, kept only if count_total
+    bool count_total = false;
+    bool simd = true;                  // scan with argmin_finish; false: argmin_scalar
+    std::unique_ptr<std::atomic<vtime_t>[]> outbox;    // null: not sharing; own vfinish moves not yet sent
+
+    vtime_t cost(char type, int base, size_t i) const { return model.cost(type, base, s[i].role); }
+    void observe(size_t i, char type, int base, vtime_t took) { model.observe(type, base, s[i].role, took); }
+
+    void init(size_t count) {
+        s.reset(new SchedSlot[count]); n = count; wrr.clear(); wrr_next = 0; heaps.reset(); outbox.reset();
+        vfinish.reset(count); role_of.reset(count);
+        live_roles.assign(1, VIDEO);
+    }
+
+    /* Once roles are set: refreshes role_of, and `min` backends or more get
+     * the per‑role index.  With all_roles, every role below it counts as
+     * live, so place() can later move a slot into a role nobody had. */
+    void build_index(size_t min = INDEX_MIN, size_t all_roles = 0) {
+        heaps.reset(); live_roles.clear();
+        bool seen[MAX_ROLES] = {};
+        for (size_t i=0;i<n;++i) { role_of[i] = s[i].role; if (!seen[s[i].role]) { seen[s[i].role] = true; live_roles.push_back(s[i].role); } }
+        for (size_t r=0;r<all_roles && r<size_t(MAX_ROLES);++r) if (!seen[r]) live_roles.push_back(Role(r));
+        if (n < min) return;
+        heaps.reset(new RoleHeap[MAX_ROLES]); heap_pos.reset(new uint32_t[n]);
+        for (size_t i=0;i<n;++i) {
+            RoleHeap& hp = heaps[s[i].role];
+            heap_pos[i] = uint32_t(hp.h.size()); hp.h.push_back(uint32_t(i)); heap_fix(hp, heap_pos[i]);
+        }
+    }
+    vtime_t key(uint32_t i) const { return vfinish[i].load(std::memory_order_relaxed); }
+    void heap_swap(RoleHeap& hp, size_t a, size_t b) { std::swap(hp.h[a], hp.h[b]); heap_pos[hp.h[a]] = uint32_t(a); heap_pos[hp.h[b]] = uint32_t(b); }
+    // Restores heap order around position p after its key changed (caller holds hp.mtx).
+    void heap_fix(RoleHeap& hp, size_t p) {
+        while (p > 0 && key(hp.h[p]) < key(hp.h[(p-1)/2])) { heap_swap(hp, p, (p-1)/2); p = (p-1)/2; }
+        while (true) {
+            size_t l = 2*p+1, m = p;
+            if (l < hp.h.size() && key(hp.h[l]) < key(hp.h[m])) m = l;
+            if (l+1 < hp.h.size() && key(hp.h[l+1]) < key(hp.h[m])) m = l+1;
+            if (m == p) break;
+            heap_swap(hp, p, m); p = m;
+        }
+        hp.top.store(hp.h.empty() ? RoleHeap::EMPTY : hp.h[0], std::memory_order_release);
+    }
+    void heap_erase(RoleHeap& hp, uint32_t i) {
+        size_t p = heap_pos[i], last = hp.h.size()-1;
+        if (p != last) heap_swap(hp, p, last);
+        hp.h.pop_back();
+        heap_fix(hp, p < hp.h.size() ? p : 0);
+    }
+    void heap_insert(RoleHeap& hp, uint32_t i) { heap_pos[i] = uint32_t(hp.h.size()); hp.h.push_back(i); heap_fix(hp, heap_pos[i]); }
+
+    // Lay out one period of smooth WRR (nginx style) once weights are set.
+    void build_wrr() {
+        std::vector<int64_t> cur(n, 0); int64_t total = 0;
+        for (size_t i=0;i<n;++i) total += s[i].weight;
+        wrr.clear();
+        for (int64_t k=0;k<total;++k) {
+            size_t best = 0;
+            for (size_t i=0;i<n;++i) { cur[i] += s[i].weight; if (cur[i] > cur[best]) best = i; }
+            cur[best] -= total; wrr.push_back(uint32_t(best));
+        }
+    }
+
+    void share_moves() { outbox.reset(new std::atomic<vtime_t>[n]); for (size_t i=0;i<n;++i) outbox[i].store(0, std::memory_order_relaxed); }
+    void share(size_t idx, vtime_t d) { if (outbox) outbox[idx].fetch_add(d, std::memory_order_relaxed); }
+    // What this node moved idx by since the last call.
+    vtime_t take_shared(size_t idx) { return outbox[idx].exchange(0, std::memory_order_relaxed); }
+    // A peer moved idx by delta: charged like a pick if positive, corrected like settle() if not.
+    void merge(size_t idx, vtime_t delta, vtime_t now) {
+        if (!delta) return;
+        auto moved = [&](vtime_t vf) { return std::max((vf<now?now:vf) + delta, now); };
+        vtime_t vf = vfinish[idx].load(std::memory_order_relaxed);
+        if (heaps) {
+            RoleHeap& hp = heaps[s[idx].role]; std::lock_guard<std::mutex> g(hp.mtx);
+            vf = vfinish[idx].load(std::memory_order_relaxed);
+            if (vf < VT_DOWN) { vfinish[idx].store(moved(vf), std::memory_order_release); heap_fix(hp, heap_pos[idx]); }
+            return;
+        }
+        while (vf < VT_DOWN && !vfinish[idx].compare_exchange_weak(vf, moved(vf), std::memory_order_acq_rel, std::memory_order_relaxed)) {}
+    }
+
+    // Account a request on a backend chosen by a policy that did not CAS it itself.
+    void charge(size_t idx, char type, int base, vtime_t now) {
+        vtime_t vf = vfinish[idx].load(std::memory_order_relaxed), add = cost(type,base,idx)/s[idx].slots;
+        share(idx, add);
+        if (heaps) {
+            RoleHeap& hp = heaps[s[idx].role]; std::lock_guard<std::mutex> g(hp.mtx);
+            vf = vfinish[idx].load(std::memory_order_relaxed);
+            vfinish[idx].store((vf<now?now:vf)+add, std::memory_order_release); heap_fix(hp, heap_pos[idx]);
+            return;
+        }
+        while (!vfinish[idx].compare_exchange_weak(vf, (vf<now?now:vf)+add, std::memory_order_acq_rel, std::memory_order_relaxed)) {}
+    }
+
+    /* Ejects or reinstates a backend.  A down backend's vfinish is parked at
+     * VT_DOWN, so SERPT scans and role heaps rank it last without a test in
+     * the hot path; on return its backlog is reconciled to `now`, since the
+     * work queued before the ejection failed rather than drained. */
+    void set_down(size_t idx, bool d, vtime_t now) {
+        if (s[idx].retired.load(std::memory_order_acquire)) return;
+        s[idx].down.store(d, std::memory_order_release);
+        vtime_t vf = d ? VT_DOWN : now;
+        if (heaps) { RoleHeap& hp = heaps[s[idx].role]; std::lock_guard<std::mutex> g(hp.mtx); vfinish[idx].store(vf, std::memory_order_release); heap_fix(hp, heap_pos[idx]); }
+        else vfinish[idx].store(vf, std::memory_order_release);
+    }
+    bool up(size_t idx) const { return !s[idx].down.load(std::memory_order_relaxed); }
+
+    /* Backend set changes (a config reload).  A retired slot is down and
+     * parked at VT_RETIRED, so every policy passes it over, and health checks
+     * leave it alone; reinstating it starts it with an empty backlog.
+     * place() rebinds a retired slot that carries no traffic to a role,
+     * moving it between role heaps: nothing else touches a heap entry of a
+     * slot that is retired with nothing active. */
+    void set_retired(size_t idx, bool r, vtime_t now) {
+        s[idx].retired.store(r, std::memory_order_release);
+        s[idx].down.store(r, std::memory_order_release);
+        vtime_t vf = r ? VT_RETIRED : now;
+        if (heaps) { RoleHeap& hp = heaps[s[idx].role]; std::lock_guard<std::mutex> g(hp.mtx); vfinish[idx].store(vf, std::memory_order_release); heap_fix(hp, heap_pos[idx]); }
+        else vfinish[idx].store(vf, std::memory_order_release);
+    }
+    void place(size_t idx, Role r, uint32_t slots, uint32_t weight) {
+        Role old = s[idx].role;
+        if (heaps && r != old) {
+            RoleHeap &a = heaps[old], &b = heaps[r];
+            std::lock(a.mtx, b.mtx); std::lock_guard<std::mutex> ga(a.mtx, std::adopt_lock), gb(b.mtx, std::adopt_lock);
+            heap_erase(a, uint32_t(idx)); s[idx].role = r; role_of[idx] = r; heap_insert(b, uint32_t(idx));
+        } else { s[idx].role = r; role_of[idx] = r; }
+        s[idx].slots = slots; s[idx].weight = weight;
+    }
+
+    /* Tickets: a pick charges its backend est/slots, where est = cost(type,
+     * base, idx) is the service time it quoted, and the caller keeps est with
+     * the request.  settle() corrects vfinish by observed‑minus‑estimated once
+     * the request is answered; cancel() takes back the whole charge of one
+     * that failed, was shed or moved elsewhere.  Backlog already in the past
+     * needs no correction, and a correction never moves vfinish behind now;
+     * down backends are left parked at VT_DOWN. */
+    void settle(size_t idx, vtime_t est, vtime_t took, vtime_t now) { adjust(idx, (took - est)/vtime_t(s[idx].slots), now); }
+    void cancel(size_t idx, vtime_t est, vtime_t now) { adjust(idx, -est/vtime_t(s[idx].slots), now); }
+    void adjust(size_t idx, vtime_t delta, vtime_t now) {
+        if (!delta) return;
+        share(idx, delta);
+        vtime_t vf = vfinish[idx].load(std::memory_order_relaxed);
+        if (heaps) {
+            RoleHeap& hp = heaps[s[idx].role]; std::lock_guard<std::mutex> g(hp.mtx);
+            vf = vfinish[idx].load(std::memory_order_relaxed);
+            if (vf > now && vf < VT_DOWN) { vfinish[idx].store(std::max(vf + delta, now), std::memory_order_release); heap_fix(hp, heap_pos[idx]); }
+            return;
+        }
+        while (vf > now && vf < VT_DOWN && !vfinish[idx].compare_exchange_weak(vf, std::max(vf + delta, now), std::memory_order_acq_rel, std::memory_order_relaxed)) {}
+    }
+
+    void begin(size_t idx) { s[idx].active.fetch_add(1, std::memory_order_relaxed); if (count_total) total.fetch_add(1, std::memory_order_relaxed); }
+    void done(size_t idx) { s[idx].active.fetch_sub(1, std::memory_order_relaxed); if (count_total) total.fetch_sub(1, std::memory_order_relaxed); }
+
+    size_t pick(char type, int base, vtime_t now) { return heaps ? pick_indexed(type, base, now) : pick_scan(type, base, now); }
+
+    // Compare each role's least loaded backend, then advance the winner under its role lock.
+    size_t pick_indexed(char type, int base, vtime_t now) {
+      retry:
+        vtime_t best = INT64_MAX; Role br = live_roles[0];
+        for (Role r : live_roles) {
+            uint32_t top = heaps[r].top.load(std::memory_order_acquire);
+            if (top == RoleHeap::EMPTY) continue;
+            vtime_t vf = key(top), v = (vf<now?now:vf) + model.cost(type, base, r);
+            if (v<best){best=v; br=r;}
+        }
+        RoleHeap& hp = heaps[br]; std::unique_lock<std::mutex> g(hp.mtx);
+        if (hp.h.empty()) { g.unlock(); goto retry; }     // place() just emptied it
+        uint32_t idx = hp.h[0]; vtime_t vf = key(idx), add = cost(type,base,idx)/s[idx].slots;
+        vfinish[idx].store((vf<now?now:vf) + add, std::memory_order_release);
+        heap_fix(hp, 0); share(idx, add);
+        return idx;
+    }
+
+    // Lock‑free SERPT: scan a snapshot, then CAS the winner's counter; if
+    // another picker moved it in between, the snapshot is stale and we rescan.
+    // The snapshot is this thread's aligned copy of vfinish, taken with relaxed
+    // loads, so the kernel's vector loads read plain memory.
+    size_t pick_scan(char type, int base, vtime_t now) {
+        vtime_t by_role[MAX_ROLES] = {}; size_t nroles = 0;
+        for (Role r : live_roles) { by_role[r] = model.cost(type, base, r); if (r >= nroles) nroles = r + 1u; }
+        static thread_local AlignedArray<vtime_t> snap;
+        if (snap.n < n) snap.reset(n);                  // grows once per thread
+        while (true) {
+            for (size_t i=0;i<n;++i) snap[i] = vfinish[i].load(std::memory_order_relaxed);
+            vtime_t seen; size_t idx = simd ? argmin_finish(&snap[0], &role_of[0], n, now, by_role, nroles, seen) : argmin_scalar(&snap[0], &role_of[0], n, now, by_role, seen);
+            vtime_t add = cost(type,base,idx)/s[idx].slots, next = (seen<now?now:seen) + add;
+            if (vfinish[idx].compare_exchange_weak(seen, next, std::memory_order_acq_rel, std::memory_order_relaxed)) { share(idx, add); return idx; }
+        }
+    }
+
+    // SERPT over every backend but `skip`, charged like pick(); for re‑dispatching a request `skip` failed.
+    size_t pick_excluding(char type, int base, vtime_t now, size_t skip) {
+        vtime_t best = INT64_MAX; size_t idx = skip;
+        for (size_t i=0;i<n;++i) {
+            if (i==skip) continue;
+            vtime_t vf = vfinish[i].load(std::memory_order_relaxed), v = (vf<now?now:vf) + cost(type,base,i);
+            if (v<best){best=v; idx=i;}
+        }
+        charge(idx, type, base, now); return idx;
+    }
+
+    // Reference version with the original global mutex, kept for sched_bench.
+    size_t pick_locked(char type, int base, vtime_t now) {
+        std::lock_guard<std::mutex> g(mtx);
+        vtime_t best = INT64_MAX; size_t idx = 0;
+        for (size_t i=0;i<n;++i) {
+            vtime_t vf = vfinish[i].load(std::memory_order_relaxed);
+            vtime_t v = (vf<now?now:vf) + cost(type,base,i);
+            if (v<best){best=v; idx=i;}
+        }
+        vtime_t vf = vfinish[idx].load(std::memory_order_relaxed);
+        vfinish[idx].store((vf<now?now:vf) + cost(type,base,idx)/s[idx].slots, std::memory_order_relaxed);
+        return idx;
+    }
+};
+
+/* Requests not yet bound to a backend, for late binding (LatePolicy).  Each
+ * is ranked once per live role, by QueueOrder over its cost on that role, in
+ * a WaitQueue per role; a backend with room takes the best‑ranked request for
+ * its own role, so the ones its multipliers make cheap go first and a
+ * mismatched one only when nothing cheaper waits.  Taking a request leaves
+ * stale copies in the other roles' queues, skipped when they surface and
+ * swept once they outnumber the live ones.  Only grows past its high‑water
+ * mark. */
+template <class T> struct LateQueue {
+    struct Ref { uint32_t slot, gen; bool operator==(const Ref& o) const { return slot == o.slot && gen == o.gen; } };
+    std::vector<T> items; std::vector<uint32_t> gen, free_slots;
+    WaitQueue<Ref> by_role[MAX_ROLES];
+    std::vector<Role> roles;
+    size_t live = 0, entries = 0;
+
+    void init(const std::vector<Role>& live_roles) { roles = live_roles; }
+    void reserve(size_t n) { items.reserve(n); gen.reserve(n); free_slots.reserve(n); for (Role r : roles) by_role[r].reserve(2*n); }
+    bool empty() const { return !live; }
+    size_t size() const { return live; }
+
+    void push(T v, char type, int base, vtime_t at, const SchedTable& st) {
+        uint32_t slot;
+        if (free_slots.empty()) { slot = uint32_t(items.size()); items.push_back(std::move(v)); gen.push_back(0); }
+        else { slot = free_slots.back(); free_slots.pop_back(); items[slot] = std::move(v); }
+        for (Role r : roles) by_role[r].push(Ref{ slot, gen[slot] }, st.order.rank(type, st.model.cost(type, base, r), at));
+        ++live; entries += roles.size();
+    }
+    // The role, among those with room[role], whose best waiter ranks lowest; false if nothing waits.
+    bool best(const bool* room, Role& out) {
+        bool found = false; vtime_t rank = 0;
+        for (Role r : roles) {
+            if (!room[r]) continue;
+            WaitQueue<Ref>& q = by_role[r];
+            while (!q.empty() && gen[q.top().slot] != q.top().gen) { q.pop(); --entries; }
+            if (!q.empty() && (!found || q.top_rank() < rank)) { found = true; rank = q.top_rank(); out = r; }
+        }
+        return found;
+    }
+    // Removes and returns the head of r's queue; call after best() chose r.
+    T take(Role r) {
+        Ref x = by_role[r].top(); by_role[r].pop(); --entries;
+        T v = std::move(items[x.slot]); ++gen[x.slot]; free_slots.push_back(x.slot); --live;
+        if (entries > 2*live*roles.size() + 64) sweep();
+        return v;
+    }
+    void sweep() {
+        entries = 0;
+        for (Role r : roles) {
+            std::vector<typename WaitQueue<Ref>::Item>& h = by_role[r].h;
+            h.erase(std::remove_if(h.begin(), h.end(), [&](const typename WaitQueue<Ref>::Item& e) { return gen[e.v.slot] != e.v.gen; }), h.end());
+            std::make_heap(h.begin(), h.end(), WaitQueue<Ref>::later); entries += h.size();
+        }
+    }
+};
+
+static inline uint32_t sched_rand() {
+    static thread_local uint32_t x = 2463534242u ^ uint32_t(reinterpret_cast<uintptr_t>(&x));
+    x ^= x<<13; x ^= x>>17; x ^= x<<5; return x;
+}
+
+// Shortest expected remaining processing time (the original SmartLB policy).
+struct SerptPolicy {
+    static const char* name() { return "serpt"; }
+    static size_t pick(SchedTable& st, char type, int base, vtime_t now) { return st.pick(type, base, now); }
+};
+
+// Fewest outstanding requests per connection slot; ignores request cost.
+struct JsqPolicy {
+    static const char* name() { return "jsq"; }
+    static size_t pick(SchedTable& st, char type, int base, vtime_t now) {
+        size_t idx = 0; uint64_t best = UINT64_MAX;
+        for (size_t i=0;i<st.n;++i) {
+            if (st.s[i].retired.load(std::memory_order_relaxed)) continue;
+            uint64_t q = uint64_t(st.s[i].active.load(std::memory_order_relaxed))*1024/st.s[i].slots;
+            if (!st.up(i)) q += uint64_t(1) << 62;      // down: only when none is up, as SERPT ranks VT_DOWN
+            if (q<best){best=q; idx=i;}
+        }
+        if (best == UINT64_MAX) return st.pick(type, base, now);   // every slot retired
+        st.charge(idx, type, base, now); return idx;
+    }
+};
+
+// Power of two random choices on expected finish time (a down backend's VT_DOWN loses).
+struct P2cPolicy {
+    static const char* name() { return "p2c"; }
+    static size_t pick(SchedTable& st, char type, int base, vtime_t now) {
+        size_t a = sched_rand()%st.n, b = st.n>1 ? (a+1+sched_rand()%(st.n-1))%st.n : a;
+        vtime_t va = st.vfinish[a].load(std::memory_order_relaxed), vb = st.vfinish[b].load(std::memory_order_relaxed);
+        va = (va<now?now:va) + st.cost(type,base,a); vb = (vb<now?now:vb) + st.cost(type,base,b);
+        size_t idx = vb<va ? b : a;
+        if (!st.up(idx)) return st.pick(type, base, now);  // both down or retired: SERPT ranks them last
+        st.charge(idx, type, base, now); return idx;
+    }
+};
+
+// Weighted round robin over the precomputed smooth sequence.
+struct WrrPolicy {
+    static const char* name() { return "wrr"; }
+    static size_t pick(SchedTable& st, char type, int base, vtime_t now) {
+        size_t idx = 0;
+        for (size_t k=0;k<st.wrr.size();++k) {      // skip down backends, at most one period
+            idx = st.wrr[st.wrr_next.fetch_add(1, std::memory_order_relaxed)%st.wrr.size()];
+            if (st.up(idx)) break;
+        }
+        if (!st.up(idx)) return st.pick(type, base, now);  // all down or retired: SERPT ranks them last
+        st.charge(idx, type, base, now); return idx;
+    }
+};
+
+/* Late binding: engines that support it hold requests in a LateQueue and
+ * bind one when a backend has a connection free (see the epoll engine and
+ * sim); pick() is SERPT, for re‑dispatches and for engines that bind on
+ * arrival. */
+struct LatePolicy {
+    static const char* name() { return "late"; }
+    static size_t pick(SchedTable& st, char type, int base, vtime_t now) { return st.pick(type, base, now); }
+};
@@ -0,0 +1,117 @@
+/*
+ * sched_bench.cpp – pick_backend throughput: global mutex vs lock‑free CAS,
+ * then the lock‑free scan (scalar, and SIMD from ARGMIN_SIMD_MIN backends)
+ * vs the per‑role heap index as backends grow, with the smallest count at
+ * which the index won (for --index-min), the argmin kernel alone, scalar
+ * reference vs SIMD, and what a trace
+ * event costs the request path (trace.h), tracing off vs on
+ *
+ *   ./sched_bench [picks-per-thread]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "sched.h"
+#include "trace.h"
+
+using Steady = std::chrono::steady_clock;
+
+static const char TYPES[] = { 'M', 'V', 'P' };
+
+template <class Pick>
+static double run(int threads, long picks, Pick pick) {
+    Steady::time_point start = Steady::now();
+    std::vector<std::thread> ts;
+    for (int t=0;t<threads;++t) ts.emplace_back([=]{
+        uint32_t x = 2463534242u + t;  // xorshift, so the generator stays out of the measurement
+        for (long i=0;i<picks;++i) {
+            x ^= x<<13; x ^= x>>17; x ^= x<<5;
+            vtime_t now = std::chrono::duration_cast<std::chrono::microseconds>(Steady::now() - start).count();
+            pick(TYPES[x%3], int(x>>8)%9+1, now);
+        }
+    });
+    for (auto& t:ts) t.join();
+    double secs = std::chrono::duration<double>(Steady::now() - start).count();
+    return secs*1e9/(double(picks)*threads);
+}
+
+// n backends, two VIDEO per MUSIC as in the lab setup; index: build the role heaps
+static void reset(SchedTable& st, size_t n = 3, bool index = false, bool simd = true) {
+    st.init(n); st.simd = simd;
+    for (size_t i=0;i<n;++i) st.s[i].role = i%3==2 ? MUSIC : VIDEO;
+    st.build_index(index ? 1 : SIZE_MAX);
+}
+
+static volatile size_t sink;
+
+// ns per argmin over n backends; checks the kernel agrees with the reference
+template <class K> static double kernel_ns(size_t n, long reps, K kernel, size_t* out) {
+    AlignedArray<vtime_t> vf; AlignedArray<uint8_t> role; vf.reset(n); role.reset(n);
+    vtime_t cost[MAX_ROLES] = { 3000000, 2000000 };
+    uint32_t x = 2463534242u;
+    for (size_t i=0;i<n;++i) { x ^= x<<13; x ^= x>>17; x ^= x<<5; vf[i] = x % 50000000; role[i] = i%3==2 ? MUSIC : VIDEO; }
+    Steady::time_point start = Steady::now(); vtime_t seen;
+    for (long r=0;r<reps;++r) sink = sink + kernel(&vf[0], &role[0], n, vtime_t(r % 1000) * 40000, cost, seen);
+    double secs = std::chrono::duration<double>(Steady::now() - start).count();
+    *out = kernel(&vf[0], &role[0], n, 20000000, cost, seen);
+    return secs*1e9/double(reps);
+}
+
+// ns per recorded event, a request's worth at a time, with `capacity` events per ring (0 = off)
+static double trace_ns(int threads, long requests, size_t capacity) {
+    static Tracer tracer; tracer.set_capacity(capacity);
+    Steady::time_point start = Steady::now();
+    std::vector<std::thread> ts;
+    for (int t=0;t<threads;++t) ts.emplace_back([=]{
+        for (long i=0;i<requests;++i) {
+            uint32_t id = tracer.new_id();
+            for (int k=TR_ACCEPT;k<TRACE_KINDS;++k) tracer.record(TraceKind(k), id, size_t(i&7));
+        }
+    });
+    for (auto& t:ts) t.join();
+    double secs = std::chrono::duration<double>(Steady::now() - start).count();
+    return secs*1e9/(double(requests)*TRACE_KINDS*threads);
+}
+
+int main(int argc, char** argv) {
+    long picks = argc>1 ? std::atol(argv[1]) : 200000;
+    std::printf("%8s %14s %14s\n", "threads", "mutex ns/pick", "cas ns/pick");
+    for (int threads : {1, 8, 64}) {
+        SchedTable st;
+        reset(st); double locked = run(threads, picks, [&](char t, int b, vtime_t n){ st.pick_locked(t,b,n); });
+        reset(st); double lockfree = run(threads, picks, [&](char t, int b, vtime_t n){ st.pick(t,b,n); });
+        std::printf("%8d %14.1f %14.1f\n", threads, locked, lockfree);
+    }
+    std::printf("\n%8s %8s %14s %14s %14s\n", "backends", "threads", "scalar ns/pick", "simd ns/pick", "index ns/pick");
+    size_t index_from = 0;                      // smallest n from which the index beat both scans
+    for (size_t n : {3, 8, 16, 32, 64, 128, 512, 1024}) {
+        bool index_won = true;
+        for (int threads : {1, 8}) {
+            SchedTable st;
+            reset(st, n, false, false); double scalar = run(threads, picks, [&](char t, int b, vtime_t now){ st.pick(t,b,now); });
+            reset(st, n); double simd = run(threads, picks, [&](char t, int b, vtime_t now){ st.pick(t,b,now); });
+            reset(st, n, true); double index = run(threads, picks, [&](char t, int b, vtime_t now){ st.pick(t,b,now); });
+            std::printf("%8zu %8d %14.1f %14.1f %14.1f\n", n, threads, scalar, n < ARGMIN_SIMD_MIN ? scalar : simd, index);
+            index_won = index_won && index < scalar && index < simd;
+        }
+        if (!index_won) index_from = 0; else if (!index_from) index_from = n;
+    }
+    if (index_from) std::printf("index wins from %zu backends: --index-min=%zu\n", index_from, index_from);
+    else std::printf("the scan won at 1024 backends: --index-min above that\n");
+    std::printf("\n%8s %16s %16s\n", "backends", "scalar ns/scan", "simd ns/scan");
+    for (size_t n : {8, 64, 512}) {
+        size_t a, b; long reps = picks * 10 / long(n) + 1;
+        double scalar = kernel_ns(n, reps, argmin_scalar, &a);
+        double simd = kernel_ns(n, reps, [](const vtime_t* vf, const uint8_t* r, size_t k, vtime_t now, const vtime_t* c, vtime_t& seen){ return argmin_finish(vf, r, k, now, c, 2, seen); }, &b);
+        std::printf("%8zu %16.1f %16.1f%s\n", n, scalar, simd, a == b ? "" : "  MISMATCH");
+    }
+    std::printf("\n%8s %14s %14s\n", "threads", "off ns/event", "on ns/event");
+    for (int threads : {1, 8}) {
+        double off = trace_ns(threads, picks, 0), on = trace_ns(threads, picks, 16384);
+        std::printf("%8d %14.1f %14.1f\n", threads, off, on);
+    }
+}
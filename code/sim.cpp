@@ -0,0 +1,228 @@
+/*
+ * sim.cpp – discrete‑event simulation of SmartLB scheduling policies
+ *
+ *   ./sim [--policy=all|serpt|jsq|p2c|wrr|late] [--backends=VIDEO,VIDEO,MUSIC] [--role=SPEC]
+ *         [--slots=K] [--weights=W,..] [--speed=F,..] [--noise=SIGMA]
+ *         [--adaptive=ALPHA] [--no-settle] [--seed=S] [--repeat=N]
+ *         [--queue=srpt|fifo] [--queue-aging=A] [--deadline=T=SEC].. [--nodes=K [--gossip=SEC]]
+ *         (--synthetic=N [--rate=R] [--mix=MVP] | FILE...)
+ *
+ * Runs the LB's own SchedTable and policies from sched.h in virtual time
+ * against modeled backends, each with K parallel slots that take queued jobs
+ * in the LB's queue order (--queue, as for the LB's pools).  A request's true
+ * service time is multiplier()*base seconds, scaled by the backend's --speed
+ * factor and by lognormal --noise, so the scheduler's estimate can be wrong in
+ * the same ways it is on real servers.  Input is either N synthetic Poisson
+ * arrivals at R req/s with types drawn from --mix, or the workload files
+ * loadgen replays (closed‑loop h*.in scripts, open‑loop timed traces).
+ * Completions settle their tickets as the LB does; --no-settle leaves vfinish
+ * at the estimate, for comparison.  The late policy holds arrivals in a
+ * LateQueue and binds one whenever a backend has a slot free and nothing
+ * queued, as the LB's epoll engine does with --policy=late.
+ *
+ * --nodes=K splits arrivals round‑robin (a script copy sticks to one) over K
+ * LB nodes, each with its own SchedTable, as a cluster of LBs would; with
+ * --gossip=SEC they exchange their vfinish moves every SEC of virtual time
+ * as the LB's --peer option does, without it each schedules blind to the
+ * others.  Late binding keeps one queue regardless.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "sched.h"
+#include "workload.h"
+
+struct Job { char type; int base; vtime_t arrive; int host; vtime_t est; size_t node; };   // host -1: open loop; est: ticket on node's table
+
+struct Event {
+    enum Kind { ARRIVAL, COMPLETION, GOSSIP } kind;
+    vtime_t t; size_t backend; vtime_t service; Job job;
+    bool operator>(const Event& o) const { return t > o.t; }
+};
+
+struct SimBackend { WaitQueue<Job> queue; uint32_t busy = 0; vtime_t busy_time = 0; double speed = 1; };
+
+struct Options {
+    std::vector<Role> roles{VIDEO, VIDEO, MUSIC};
+    std::vector<uint32_t> weights; std::vector<double> speeds;
+    uint32_t slots = 1; double noise = 0, alpha = 0.125, rate = 1; long synthetic = 0; int repeat = 1; bool settle = true;
+    std::string mix = "MVP"; uint64_t seed = 1; QueueOrder order;
+    size_t nodes = 1; double gossip = 0;
+    std::vector<Script> scripts;
+};
+
+struct Result { vtime_t makespan = 0; std::vector<double> util; std::map<char, std::vector<double>> lat; };
+
+template <class P> static Result simulate(const Options& o) {
+    std::unique_ptr<SchedTable[]> tables(new SchedTable[o.nodes]);
+    std::vector<SimBackend> bs(o.roles.size());
+    for (size_t k=0;k<o.nodes;++k) {
+        SchedTable& t = tables[k]; t.init(o.roles.size()); t.model.alpha = o.alpha; t.order = o.order;
+        for (size_t i=0;i<bs.size();++i) { t.s[i].role = o.roles[i]; t.s[i].slots = o.slots; if (i < o.weights.size()) t.s[i].weight = o.weights[i]; }
+        t.build_wrr(); t.build_index();
+        if (o.nodes > 1 && o.gossip > 0) t.share_moves();
+    }
+    SchedTable& st = tables[0];
+    for (size_t i=0;i<bs.size() && i<o.speeds.size();++i) bs[i].speed = o.speeds[i];
+    std::mt19937_64 rng(o.seed);
+    std::lognormal_distribution<double> noise(0, o.noise);
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> evq;
+    auto arrival = [&](vtime_t t, char type, int base, int host) { evq.push(Event{Event::ARRIVAL, t, 0, 0, Job{type, base, t, host, 0, 0}}); };
+
+    // Synthetic Poisson stream, open‑loop traces, and the first request of every script copy.
+    std::vector<std::pair<const Script*, size_t>> hosts;
+    if (o.synthetic) {
+        std::exponential_distribution<double> gap(o.rate); std::uniform_int_distribution<int> base(1, 9), type(0, int(o.mix.size())-1);
+        double t = 0;
+        for (long k=0;k<o.synthetic;++k) { t += gap(rng); arrival(vtime_t(t*VT_PER_SEC), o.mix[type(rng)], base(rng), -1); }
+    }
+    for (int r=0;r<o.repeat;++r) for (const Script& sc : o.scripts) {
+        if (sc.reqs.empty()) continue;
+        if (sc.timed) { for (const Req& q : sc.reqs) arrival(vtime_t(q.at_ms*1000), q.req[0], q.req[1]-'0', -1); continue; }
+        hosts.emplace_back(&sc, 0);
+        arrival(0, sc.reqs[0].req[0], sc.reqs[0].req[1]-'0', int(hosts.size()-1));
+    }
+
+    auto start_next = [&](size_t i, vtime_t now) {
+        SimBackend& b = bs[i];
+        while (!b.queue.empty() && b.busy < o.slots) {
+            Job j = b.queue.top(); b.queue.pop(); ++b.busy;
+            double f = b.speed * (o.noise > 0 ? noise(rng) : 1.0);
+            vtime_t service = std::max<vtime_t>(1, vtime_t(double(cost_ticks(j.type, j.base, st.s[i].role)) * f));
+            b.busy_time += service;
+            evq.push(Event{Event::COMPLETION, now + service, i, service, j});
+        }
+    };
+
+    auto assign = [&](size_t i, Job j, vtime_t now) {
+        j.est = tables[j.node].cost(j.type, j.base, i);
+        bs[i].queue.push(j, st.order.rank(j.type, j.est, j.arrive)); start_next(i, now);
+    };
+    // Late binding: while a backend has a slot free, it takes the best waiter for its role.
+    LateQueue<Job> late; late.init(st.live_roles);
+    auto bind_late = [&](vtime_t now) {
+        while (!late.empty()) {
+            bool room[MAX_ROLES] = {}; size_t free_of[MAX_ROLES] = {};
+            for (size_t i=0;i<bs.size();++i) {
+                if (bs[i].busy >= o.slots || !bs[i].queue.empty()) continue;
+                Role r = st.s[i].role;
+                if (!room[r] || st.key(uint32_t(i)) < st.key(uint32_t(free_of[r]))) { room[r] = true; free_of[r] = i; }
+            }
+            Role r = VIDEO; if (!late.best(room, r)) return;
+            Job j = late.take(r); size_t i = free_of[r];
+            st.charge(i, j.type, j.base, now); st.begin(i); assign(i, j, now);
+        }
+    };
+    const bool late_bind = std::is_same<P, LatePolicy>::value;
+    const vtime_t gossip = vtime_t(o.gossip*VT_PER_SEC);
+    if (st.outbox) evq.push(Event{Event::GOSSIP, gossip, 0, 0, Job{}});
+    size_t arrivals = 0;
+
+    Result res;
+    while (!evq.empty()) {
+        Event e = evq.top(); evq.pop();
+        if (e.kind == Event::GOSSIP) {                      // every node's moves since the last round, to all the others
+            for (size_t k=0;k<o.nodes;++k) for (size_t i=0;i<bs.size();++i) {
+                vtime_t d = tables[k].take_shared(i);
+                for (size_t m=0;m<o.nodes;++m) if (m != k) tables[m].merge(i, d, e.t);
+            }
+            if (!evq.empty()) evq.push(Event{Event::GOSSIP, e.t + gossip, 0, 0, Job{}});
+            continue;
+        }
+        if (e.kind == Event::ARRIVAL) {
+            if (late_bind) { late.push(e.job, e.job.type, e.job.base, e.job.arrive, st); bind_late(e.t); continue; }
+            e.job.node = e.job.host >= 0 ? size_t(e.job.host) % o.nodes : arrivals++ % o.nodes;
+            SchedTable& t = tables[e.job.node];
+            size_t i = P::pick(t, e.job.type, e.job.base, e.t); t.begin(i);
+            assign(i, e.job, e.t);
+            continue;
+        }
+        SimBackend& b = bs[e.backend]; --b.busy;
+        SchedTable& t = tables[e.job.node];
+        t.done(e.backend); t.observe(e.backend, e.job.type, e.job.base, e.service);
+        if (o.settle) t.settle(e.backend, e.job.est, e.service, e.t);
+        res.lat[e.job.type].push_back(double(e.t - e.job.arrive) / VT_PER_SEC);
+        res.makespan = e.t;
+        if (e.job.host >= 0) {                              // closed loop: the host sends its next request
+            auto& h = hosts[e.job.host];
+            if (++h.second < h.first->reqs.size()) arrival(e.t, h.first->reqs[h.second].req[0], h.first->reqs[h.second].req[1]-'0', e.job.host);
+        }
+        start_next(e.backend, e.t);
+        if (late_bind) bind_late(e.t);
+    }
+    for (const SimBackend& b : bs) res.util.push_back(res.makespan ? double(b.busy_time) / (double(res.makespan) * o.slots) : 0);
+    return res;
+}
+
+static double pct(const std::vector<double>& v, double p) { return v.empty() ? 0 : v[std::min(v.size()-1, size_t(p*(v.size()-1)+0.5))]; }
+
+static void report(const char* name, Result& r) {
+    std::vector<double> all; for (auto& kv : r.lat) { std::sort(kv.second.begin(), kv.second.end()); all.insert(all.end(), kv.second.begin(), kv.second.end()); }
+    std::sort(all.begin(), all.end());
+    double mean = 0; for (double x : all) mean += x; if (!all.empty()) mean /= all.size();
+    std::printf("%-6s makespan %10.2f s  mean %8.2f  p50 %8.2f  p99 %8.2f  p999 %8.2f  util", name, double(r.makespan)/VT_PER_SEC, mean, pct(all,.5), pct(all,.99), pct(all,.999));
+    for (double u : r.util) std::printf(" %4.0f%%", u*100);
+    std::printf("\n");
+    for (auto& kv : r.lat) std::printf("       %c: n=%zu p50 %.2f p99 %.2f p999 %.2f\n", kv.first, kv.second.size(), pct(kv.second,.5), pct(kv.second,.99), pct(kv.second,.999));
+}
+
+template <class P> static void run(const Options& o) { Result r = simulate<P>(o); report(P::name(), r); }
+
+template <class T, class F> static std::vector<T> split(const std::string& s, F conv) {
+    std::vector<T> out; size_t p = 0;
+    while (p <= s.size()) { size_t c = s.find(',', p); if (c == std::string::npos) c = s.size(); out.push_back(conv(s.substr(p, c-p))); p = c+1; }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    Options o; std::string policy = "all"; std::vector<std::string> role_names;
+    for (int i=1;i<argc;++i) {
+        std::string a = argv[i], v = a.substr(a.find('=')+1);
+        if (a.compare(0, 9, "--policy=") == 0) policy = v;
+        else if (a.compare(0, 11, "--backends=") == 0) {
+            o.roles.clear();
+            role_names = split<std::string>(v, [](const std::string& x){ return x; });
+        }
+        else if (a.compare(0, 7, "--role=") == 0) { if (!roles().define(v)) { std::cerr << "bad role " << v << "\n"; return 1; } }
+        else if (a.compare(0, 8, "--slots=") == 0) o.slots = std::max(1, std::atoi(v.c_str()));
+        else if (a.compare(0, 10, "--weights=") == 0) o.weights = split<uint32_t>(v, [](const std::string& x){ return uint32_t(std::max(1, std::atoi(x.c_str()))); });
+        else if (a.compare(0, 8, "--speed=") == 0) o.speeds = split<double>(v, [](const std::string& x){ return std::atof(x.c_str()); });
+        else if (a.compare(0, 8, "--noise=") == 0) o.noise = std::atof(v.c_str());
+        else if (a.compare(0, 11, "--adaptive=") == 0) o.alpha = std::atof(v.c_str());
+        else if (a == "--no-settle") o.settle = false;
+        else if (a.compare(0, 7, "--seed=") == 0) o.seed = std::strtoull(v.c_str(), nullptr, 10);
+        else if (a.compare(0, 9, "--repeat=") == 0) o.repeat = std::max(1, std::atoi(v.c_str()));
+        else if (a.compare(0, 12, "--synthetic=") == 0) o.synthetic = std::atol(v.c_str());
+        else if (a.compare(0, 7, "--rate=") == 0) o.rate = std::atof(v.c_str());
+        else if (a.compare(0, 6, "--mix=") == 0) o.mix = v;
+        else if (a == "--queue=srpt" || a == "--queue=fifo") o.order.fifo = v == "fifo";
+        else if (a.compare(0, 14, "--queue-aging=") == 0) o.order.aging = std::max(0.0, std::atof(v.c_str()));
+        else if (a.compare(0, 11, "--deadline=") == 0) { if (!o.order.set_deadline(a.substr(11))) { std::cerr << "bad deadline " << a.substr(11) << "\n"; return 1; } }
+        else if (a.compare(0, 8, "--nodes=") == 0) o.nodes = size_t(std::max(1, std::atoi(v.c_str())));
+        else if (a.compare(0, 9, "--gossip=") == 0) o.gossip = std::max(0.0, std::atof(v.c_str()));
+        else if (a.compare(0, 2, "--") == 0) { std::cerr << "usage: " << argv[0] << " [--policy=all|serpt|jsq|p2c|wrr|late] [--backends=R,..] [--role=SPEC] [--slots=K] [--weights=W,..] [--speed=F,..] [--noise=S] [--adaptive=A] [--no-settle] [--seed=S] [--repeat=N] [--queue=srpt|fifo] [--queue-aging=A] [--deadline=T=SEC].. [--nodes=K [--gossip=SEC]] (--synthetic=N [--rate=R] [--mix=MVP] | FILE...)\n"; return 1; }
+        else { o.scripts.emplace_back(); if (!load_script(a, o.scripts.back())) return 1; }
+    }
+    for (const std::string& r : role_names) {              // after all --role definitions
+        int i = roles().find(r); if (i < 0) { std::cerr << "unknown role " << r << "\n"; return 1; }
+        o.roles.push_back(Role(i));
+    }
+    if (o.roles.empty() || o.rate <= 0 || o.mix.empty() || (!o.synthetic && o.scripts.empty())) { std::cerr << "sim: need backends and a workload (--synthetic=N or FILE...)\n"; return 1; }
+    bool all = policy == "all", any = false;
+    if (all || policy == "serpt") { run<SerptPolicy>(o); any = true; }
+    if (all || policy == "jsq") { run<JsqPolicy>(o); any = true; }
+    if (all || policy == "p2c") { run<P2cPolicy>(o); any = true; }
+    if (all || policy == "wrr") { run<WrrPolicy>(o); any = true; }
+    if (all || policy == "late") { run<LatePolicy>(o); any = true; }
+    if (!any) { std::cerr << "unknown policy " << policy << "\n"; return 1; }
+}
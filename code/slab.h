@@ -0,0 +1,49 @@
+/*
+ * slab.h – containers for an allocation‑free request path
+ *
+ * Ring<T> is a growable circular FIFO for the engines' queues: it only
+ * allocates when it outgrows its high‑water mark, where std::deque allocates
+ * and frees a node every few dozen push/pop pairs.  Slab<T> is a per‑thread
+ * free list of per‑connection objects: put() keeps the object, with whatever
+ * buffer capacity it holds, for the next get(), so the caller's reset() can
+ * reinitialise it without freeing anything; put() itself never allocates.
+ */
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+template <class T> struct Ring {
+    std::vector<T> buf; size_t head = 0, n = 0;         // buf.size() is 0 or a power of two
+
+    bool empty() const { return n == 0; }
+    size_t size() const { return n; }
+    T& front() { return buf[head]; }
+    T& back() { return buf[(head + n - 1) & (buf.size() - 1)]; }
+    T& operator[](size_t i) { return buf[(head + i) & (buf.size() - 1)]; }
+    void push_back(T x) { if (n == buf.size()) grow(); buf[(head + n++) & (buf.size() - 1)] = std::move(x); }
+    void pop_front() { buf[head] = T(); head = (head + 1) & (buf.size() - 1); --n; }
+    void clear() { while (n) pop_front(); head = 0; }
+    void reserve(size_t want) { while (buf.size() < want) grow(); }
+    void swap(Ring& o) { buf.swap(o.buf); std::swap(head, o.head); std::swap(n, o.n); }
+
+  private:
+    void grow() {
+        std::vector<T> nb(buf.empty() ? 8 : buf.size() * 2);
+        for (size_t i = 0; i < n; ++i) nb[i] = std::move((*this)[i]);
+        buf.swap(nb); head = 0;
+    }
+};
+
+template <class T> struct Slab {
+    std::vector<T*> free_list; size_t total = 0;         // free_list always has room for every object made
+
+    T* get() {
+        if (free_list.empty()) { if (free_list.capacity() < ++total) free_list.reserve(2 * total); return new T; }
+        T* p = free_list.back(); free_list.pop_back(); return p;
+    }
+    void put(T* p) { free_list.push_back(p); }
+    void prefill(size_t want) { free_list.reserve(want); for (; total < want; ++total) free_list.push_back(new T); }
+    ~Slab() { for (T* p : free_list) delete p; }
+};
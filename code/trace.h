@@ -0,0 +1,116 @@
+/*
+ * trace.h – always‑on per‑request tracing into per‑thread rings, Chrome trace export
+ *
+ * Each thread that records gets a ring of its own (single writer, so a
+ * record is a TSC read, a 16‑byte store and a release of the head: no
+ * atomics shared between threads).  A ring keeps the last `capacity` events
+ * and overwrites the oldest; rings of threads that exit go back to a free
+ * list, so the thread‑per‑client engine reuses them.  Past MAX_RINGS live
+ * threads, the rest record nothing.
+ *
+ * An event names its request by a 32‑bit id (ring index, then a per‑ring
+ * counter), so the phases of one request line up in the dump even when
+ * they were recorded on different threads.  dump() snapshots every ring
+ * without stopping the writers: it reads head, copies, reads head again and
+ * drops whatever the writer may have overwritten meanwhile, then converts
+ * TSC to microseconds against the steady clock and writes Chrome trace /
+ * Perfetto JSON, one async track per request with a slice per phase.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t trace_clock() { return __rdtsc(); }
+#else
+static inline uint64_t trace_clock() { return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count()); }
+#endif
+
+/* A request's path, in order; a phase in the dump is named for the event
+ * that ends it.  LOCKED is when the threads engine holds Backend::mtx;
+ * CHECKOUT when the request has its upstream connection, CONNECTED after
+ * one was (re)opened for it. */
+enum TraceKind : uint8_t { TR_ACCEPT, TR_PARSED, TR_PICKED, TR_LOCKED, TR_CHECKOUT, TR_CONNECTED, TR_SENT, TR_FIRST_BYTE, TR_DONE, TRACE_KINDS };
+
+struct TraceEvent { uint64_t tsc; uint32_t id; uint16_t backend; uint8_t kind, pad; };
+
+struct TraceRing {
+    std::unique_ptr<TraceEvent[]> ev;
+    size_t mask = 0;
+    std::atomic<uint64_t> head{0};
+    uint32_t index = 0, next_id = 0;
+
+    void put(TraceKind k, uint32_t id, size_t backend) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        ev[h & mask] = TraceEvent{ trace_clock(), id, uint16_t(backend), k, 0 };
+        head.store(h + 1, std::memory_order_release);
+    }
+    uint32_t new_id() { next_id = (next_id + 1) & 0xffffff; if (!next_id) next_id = 1; return index << 24 | next_id; }
+};
+
+struct Tracer {
+    static const size_t MAX_RINGS = 256;
+    size_t capacity = 16384;                        // events per ring, a power of two; 0 = off
+    TraceRing rings[MAX_RINGS];
+    std::mutex mtx; std::vector<uint32_t> free_rings; uint32_t used = 0;     // mtx
+    uint64_t tsc0 = trace_clock(); std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    struct Holder {
+        Tracer* t = nullptr; TraceRing* r = nullptr;
+        ~Holder() { if (r) { std::lock_guard<std::mutex> g(t->mtx); t->free_rings.push_back(r->index); } }
+    };
+    void set_capacity(size_t n) { capacity = 0; if (n) { capacity = 1; while (capacity < n) capacity <<= 1; } }
+    // This thread's ring, set up on its first event; nullptr when off or out of rings.
+    TraceRing* mine() {
+        static thread_local Holder h;
+        if (h.r || !capacity) return h.r;
+        std::lock_guard<std::mutex> g(mtx);
+        if (!free_rings.empty()) { h.r = &rings[free_rings.back()]; free_rings.pop_back(); }
+        else if (used < MAX_RINGS) { h.r = &rings[used]; h.r->index = used++; h.r->ev.reset(new TraceEvent[capacity]); h.r->mask = capacity - 1; }
+        h.t = this;
+        return h.r;
+    }
+    uint32_t new_id() { TraceRing* r = mine(); return r ? r->new_id() : 0; }
+    void record(TraceKind k, uint32_t id, size_t backend) { if (!id) return; if (TraceRing* r = mine()) r->put(k, id, backend); }
+
+    std::string dump() {
+        static const char* phase[TRACE_KINDS] = { "accept", "read", "pick", "lock", "queue", "connect", "send", "server", "reply" };
+        std::vector<TraceEvent> all;
+        { std::lock_guard<std::mutex> g(mtx);
+          for (uint32_t i = 0; i < used; ++i) {
+              TraceRing& r = rings[i];
+              uint64_t cap = r.mask + 1, end = r.head.load(std::memory_order_acquire), begin = end > cap ? end - cap : 0;
+              size_t from = all.size();
+              for (uint64_t k = begin; k < end; ++k) all.push_back(r.ev[k & r.mask]);
+              uint64_t now = r.head.load(std::memory_order_acquire);          // overwritten while copying: drop
+              if (now > cap && now - cap > begin) all.erase(all.begin() + from, all.begin() + from + std::min<size_t>(all.size() - from, size_t(now - cap - begin)));
+          } }
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        double per_us = us > 0 ? double(trace_clock() - tsc0) / us : 1;
+        std::sort(all.begin(), all.end(), [](const TraceEvent& a, const TraceEvent& b) { return a.id != b.id ? a.id < b.id : a.tsc < b.tsc; });
+        std::string out = "{\"traceEvents\":[\n"; char line[256]; bool first = true;
+        auto emit = [&](const char* name, char ph, uint32_t id, uint64_t tsc, unsigned backend) {
+            std::snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"cat\":\"req\",\"ph\":\"%c\",\"id\":\"0x%x\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"backend\":%u}}",
+                          first ? "" : ",\n", name, ph, id, double(tsc - tsc0) / per_us, id >> 24, backend);
+            out += line; first = false;
+        };
+        for (size_t i = 0, j; i < all.size(); i = j) {
+            for (j = i + 1; j < all.size() && all[j].id == all[i].id; ++j) {}
+            if (j - i < 2) continue;
+            unsigned backend = all[j-1].backend;
+            emit("request", 'b', all[i].id, all[i].tsc, backend);
+            for (size_t k = i + 1; k < j; ++k) { emit(phase[all[k].kind], 'b', all[k].id, all[k-1].tsc, backend); emit(phase[all[k].kind], 'e', all[k].id, all[k].tsc, backend); }
+            emit("request", 'e', all[i].id, all[j-1].tsc, backend);
+        }
+        return out + "\n]}\n";
+    }
+};
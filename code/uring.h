@@ -0,0 +1,95 @@
+/*
+ * uring.h – minimal io_uring over raw syscalls (no liburing dependency)
+ *
+ * Just enough for the LB's uring engine: one ring per reactor thread, SQEs
+ * handed out in order and submitted together with the wait for completions,
+ * so a loop iteration costs one io_uring_enter no matter how many sockets it
+ * touched.  LB_HAVE_URING is 0 where the kernel headers are missing; the
+ * engine then refuses to start and the LB falls back to epoll.
+ */
+#pragma once
+
+#if __has_include(<linux/io_uring.h>)
+#define LB_HAVE_URING 1
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+struct Uring {
+    int fd = -1;
+    unsigned sq_entries = 0, cq_entries = 0, sq_mask = 0, cq_mask = 0;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_array = nullptr, *cq_head = nullptr, *cq_tail = nullptr;
+    io_uring_sqe* sqes = nullptr; io_uring_cqe* cqes = nullptr;
+    void* sq_ring = nullptr; size_t sq_ring_sz = 0, sqes_sz = 0;
+    unsigned pending = 0;              // SQEs queued since the last enter
+
+    // false with errno set if the kernel (or a seccomp filter) refuses io_uring
+    bool init(unsigned entries) {
+        io_uring_params p; memset(&p, 0, sizeof(p));
+        fd = int(syscall(__NR_io_uring_setup, entries, &p)); if (fd < 0) return false;
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP)) { close(fd); fd = -1; errno = ENOSYS; return false; }
+        sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe); if (cq_sz > sq_ring_sz) sq_ring_sz = cq_sz;
+        sq_ring = mmap(nullptr, sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        sqes_sz = p.sq_entries * sizeof(io_uring_sqe);
+        void* s = mmap(nullptr, sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || s == MAP_FAILED) { close(fd); fd = -1; return false; }
+        char* r = static_cast<char*>(sq_ring); sqes = static_cast<io_uring_sqe*>(s);
+        sq_head = (unsigned*)(r + p.sq_off.head); sq_tail = (unsigned*)(r + p.sq_off.tail); sq_array = (unsigned*)(r + p.sq_off.array);
+        sq_mask = *(unsigned*)(r + p.sq_off.ring_mask); sq_entries = p.sq_entries;
+        cq_head = (unsigned*)(r + p.cq_off.head); cq_tail = (unsigned*)(r + p.cq_off.tail); cqes = (io_uring_cqe*)(r + p.cq_off.cqes);
+        cq_mask = *(unsigned*)(r + p.cq_off.ring_mask); cq_entries = p.cq_entries;
+        return true;
+    }
+
+    int register_buffers(const iovec* iov, unsigned n) { return int(syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, n)); }
+
+    // Makes room for a linked chain of n SQEs, so it is not split across submissions.
+    void room(unsigned n) { if (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + n > sq_entries) enter(0); }
+
+    // Next free SQE, zeroed; submits early if the queue is full.
+    io_uring_sqe* sqe() {
+        unsigned tail = *sq_tail;
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) { enter(0); tail = *sq_tail; }
+        io_uring_sqe* e = &sqes[tail & sq_mask]; memset(e, 0, sizeof(*e));
+        sq_array[tail & sq_mask] = tail & sq_mask;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE); ++pending;
+        return e;
+    }
+    io_uring_sqe* prep(uint8_t op, int sfd, const void* addr, unsigned len, uint64_t off, uint64_t data) {
+        io_uring_sqe* e = sqe(); e->opcode = op; e->fd = sfd; e->addr = uint64_t(uintptr_t(addr)); e->len = len; e->off = off; e->user_data = data;
+        return e;
+    }
+
+    // Submits everything queued and waits for at least `wait` completions.  The
+    // kernel stops a batch at an SQE it cannot prepare (posting its CQE with the
+    // error); the rest are submitted again, so no later link chain is split.
+    int enter(unsigned wait) {
+        unsigned n = pending; pending = 0;
+        while (true) {
+            int r = int(syscall(__NR_io_uring_enter, fd, n, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+            if (r > 0 && unsigned(r) < n) { n -= unsigned(r); continue; }
+            if (r >= 0 || errno != EINTR) return r;
+            n = 0;
+        }
+    }
+
+    // Calls f(cqe) for every completion ready now.
+    template <class F> unsigned reap(F f) {
+        unsigned head = *cq_head, tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE), seen = 0;
+        for (; head != tail; ++head, ++seen) f(cqes[head & cq_mask]);
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return seen;
+    }
+};
+
+#else
+#define LB_HAVE_URING 0
+#endif
@@ -0,0 +1,40 @@
+/*
+ * workload.h – client scripts and timed traces shared by loadgen and sim
+ *
+ * A file is either a client script in the h*.in format ("M1M2M3": requests
+ * sent one after another, like client.py) or a timed trace with one
+ * "<offset_ms> <request>" per line.
+ */
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Req { double at_ms; char req[2]; };
+struct Script { std::string name; bool timed; std::vector<Req> reqs; };
+
+static inline bool valid_req(const char* r) { return r[0] >= 'A' && r[0] <= 'Z' && r[1] >= '1' && r[1] <= '9'; }
+
+static inline bool load_script(const std::string& path, Script& sc) {
+    std::ifstream in(path); if (!in) { std::cerr << "cannot open " << path << "\n"; return false; }
+    sc.name = path; sc.timed = false; sc.reqs.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line); double at; std::string r;
+        if (line.find_first_of(" \t") != std::string::npos && (ls >> at >> r)) {   // timed trace line
+            if (r.size() != 2 || !valid_req(r.c_str())) { std::cerr << "bad request '" << r << "' in " << path << "\n"; return false; }
+            sc.timed = true; Req q; q.at_ms = at; q.req[0] = r[0]; q.req[1] = r[1]; sc.reqs.push_back(q);
+            continue;
+        }
+        for (size_t i = 0; i + 1 < line.size(); i += 2) {
+            if (!valid_req(&line[i])) { std::cerr << "bad request '" << line.substr(i, 2) << "' in " << path << "\n"; return false; }
+            Req q; q.at_ms = 0; q.req[0] = line[i]; q.req[1] = line[i+1]; sc.reqs.push_back(q);
+        }
+    }
+    std::stable_sort(sc.reqs.begin(), sc.reqs.end(), [](const Req& a, const Req& b){ return a.at_ms < b.at_ms; });
+    return true;
+}
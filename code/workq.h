@@ -0,0 +1,58 @@
+/*
+ * workq.h – Chase–Lev work‑stealing deque (Lê, Pop, Cohen, Zappa Nardelli,
+ * "Correct and Efficient Work‑Stealing for Weak Memory Models", PPoPP'13)
+ *
+ * One owner thread pushes and pops at the bottom; any thread may steal from
+ * the top with a single CAS.  The ring is fixed size: push fails when full so
+ * the caller can apply backpressure instead of the deque growing unbounded.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+template <class T> struct WsDeque {
+    std::unique_ptr<std::atomic<T>[]> buf;
+    int64_t mask = 0;
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+
+    explicit WsDeque(size_t cap_pow2 = 4096) : buf(new std::atomic<T>[cap_pow2]), mask(int64_t(cap_pow2) - 1) {}
+
+    // owner only
+    bool push(T x) {
+        int64_t b = bottom.load(std::memory_order_relaxed), t = top.load(std::memory_order_acquire);
+        if (b - t > mask) return false;
+        buf[b & mask].store(x, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+    // owner only; LIFO end
+    bool pop(T& out) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) { bottom.store(b + 1, std::memory_order_relaxed); return false; }
+        out = buf[b & mask].load(std::memory_order_relaxed);
+        if (t == b) {                   // last element: race the thieves for it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+    // any thread; FIFO end.  False when empty or when another thief won the race.
+    bool steal(T& out) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return false;
+        out = buf[t & mask].load(std::memory_order_relaxed);
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+    bool empty() const { return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire); }
+};